@@ -1,6 +1,6 @@
 Summary: AMC Drive interface library
 Name: libamc
-Version: 0.1.0
+Version: 0.2.0
 Release: 1
 License: LGPL V3+
 Packager: Jim George
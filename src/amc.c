@@ -11,16 +11,19 @@ drives
 #include <unistd.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
-#include <poll.h>
+#include <time.h>
 #include <errno.h>
 #include <sys/uio.h>
 #include <arpa/inet.h>
+#include <linux/serial.h>
 #include <config.h>
 
 #include "serial.h"
 #include "amc.h"
 #include "crc.h"
+#include "drive.h"
 
 /**
 \brief Open a serial port and set up default parameters
@@ -29,7 +32,9 @@ drives
 \return File descriptor on success, -1 on failure
 
 Open the specified serial device at the specified speed,
-with default settings for parity, number of bits, etc.
+with default settings for parity, number of bits, etc. Any integer
+rate the UART can generate is accepted on Linux, amc_serial_get_baud
+tells the rate actually achieved.
 */
 int amc_serial_open(char *dev, int spd)
 {
@@ -42,6 +47,263 @@ int amc_serial_open(char *dev, int spd)
 	}
 }
 
+/**
+\brief Open a serial port, optionally tuned for low latency
+\param *dev Name of serial device to use (eg: "/dev/ttyUSB0")
+\param spd Baud rate of the serial port
+\param flags Tuning to apply, a combination of AMC_SERIAL_* flags, or 0
+\param *applied Set to the subset of flags that took effect, can be NULL
+\return File descriptor on success, -1 on failure
+
+Opens the port as amc_serial_open does, then applies the requested tuning.
+AMC_SERIAL_LOW_LATENCY selects all of it: the driver's low latency flag,
+a 1 ms latency timer on USB-serial adapters that have one (down from the
+usual 16 ms), and non-blocking reads. Settings the port does not support
+are skipped rather than failing the open, check *applied to see which
+ones are in effect. Lowering the latency timer needs write access to sysfs.
+*/
+int amc_serial_open_flags(char *dev, int spd, int flags, int *applied)
+{
+	int fd = amc_serial_open(dev, spd);
+	int done = 0;
+
+	if (fd != -1 && flags != 0) {
+		done = serial_port_tune(fd, dev, flags);
+	}
+	if (applied != NULL) {
+		*applied = done;
+	}
+	return fd;
+}
+
+/**
+\brief Get the baud rate a serial port is set to
+\param fd File descriptor of the serial port
+\return Baud rate, or 0 if it cannot be determined
+
+Reports the rate the driver achieved, which may be slightly off the rate
+requested when it is not an exact divisor of the UART clock.
+*/
+int amc_serial_get_baud(int fd)
+{
+	return serial_port_get_baud(fd);
+}
+
+/**
+\brief Change the baud rate of an open serial port
+\param fd File descriptor of the serial port
+\param spd Baud rate to set
+\return Baud rate achieved on success, -1 on failure
+
+Drives already created on the port keep the rate they read back in
+amc_drive_new, update drv->bus->baud to keep timeouts accurate.
+*/
+int amc_serial_set_baud(int fd, int spd)
+{
+	unsigned int achieved;
+
+	if (spd <= 0) {
+		return -1;
+	}
+	achieved = serial_port_set_baud(fd, spd);
+	return (achieved == 0) ? -1 : (int)achieved;
+}
+
+/**
+\brief Convert kernel RS-485 settings to struct amc_rs485
+\param *cfg Settings to fill in
+\param *rs485 Kernel settings
+*/
+static void amc_rs485_from_kernel(struct amc_rs485 *cfg, const struct serial_rs485 *rs485)
+{
+	cfg->enabled = (rs485->flags & SER_RS485_ENABLED) != 0;
+	cfg->rts_on_send = (rs485->flags & SER_RS485_RTS_ON_SEND) != 0;
+	cfg->delay_before_send_ms = rs485->delay_rts_before_send;
+	cfg->delay_after_send_ms = rs485->delay_rts_after_send;
+	cfg->rx_during_tx = (rs485->flags & SER_RS485_RX_DURING_TX) != 0;
+}
+
+/**
+\brief Put a serial port in RS-485 half-duplex mode
+\param fd File descriptor of the serial port
+\param *cfg Settings to apply, updated with the settings that took effect
+\return 0 on success, -1 if the port does not support RS-485 mode
+
+Uses the kernel's TIOCSRS485 support, so the driver switches the
+transmitter enable (RTS) right at the frame boundaries instead of the
+application guessing when the UART has drained. Drivers may clamp the
+delays or ignore flags they cannot honour, *cfg is updated to what was
+actually applied. With rx_during_tx set the drive sees its own frames
+echoed, which the reader does not expect, so leave it off on two-wire
+buses unless the transceiver suppresses the echo.
+*/
+int amc_serial_set_rs485(int fd, struct amc_rs485 *cfg)
+{
+	struct serial_rs485 rs485;
+
+	assert(cfg != NULL);
+	memset(&rs485, 0, sizeof(rs485));
+	if (cfg->enabled) {
+		rs485.flags |= SER_RS485_ENABLED;
+		rs485.flags |= cfg->rts_on_send ? SER_RS485_RTS_ON_SEND : SER_RS485_RTS_AFTER_SEND;
+		if (cfg->rx_during_tx) {
+			rs485.flags |= SER_RS485_RX_DURING_TX;
+		}
+		rs485.delay_rts_before_send = (cfg->delay_before_send_ms > 0) ? cfg->delay_before_send_ms : 0;
+		rs485.delay_rts_after_send = (cfg->delay_after_send_ms > 0) ? cfg->delay_after_send_ms : 0;
+	}
+	if (serial_port_set_rs485(fd, &rs485)) {
+		return -1;
+	}
+	amc_rs485_from_kernel(cfg, &rs485);
+	return 0;
+}
+
+/**
+\brief Read the RS-485 mode of a serial port
+\param fd File descriptor of the serial port
+\param *cfg Set to the current settings
+\return 0 on success, -1 if the port does not support RS-485 mode
+*/
+int amc_serial_get_rs485(int fd, struct amc_rs485 *cfg)
+{
+	struct serial_rs485 rs485;
+
+	assert(cfg != NULL);
+	if (serial_port_get_rs485(fd, &rs485)) {
+		return -1;
+	}
+	amc_rs485_from_kernel(cfg, &rs485);
+	return 0;
+}
+
+/**
+\brief Set up a transport for an open serial port
+\param *xprt Transport to initialize
+\param fd File descriptor of the serial port, as returned by amc_serial_open
+
+The tty transport reads and writes fd directly. Closing it with
+amc_transport_close closes fd.
+*/
+void amc_transport_tty(struct amc_transport *xprt, int fd)
+{
+	serial_port_transport(xprt, fd);
+}
+
+/**
+\brief Close a transport
+\param *xprt Transport to close
+
+Releases whatever the transport holds, such as its file descriptor. Drives
+using the transport must not be used afterwards.
+*/
+void amc_transport_close(struct amc_transport *xprt)
+{
+	assert(xprt != NULL);
+	if (xprt->ops != NULL && xprt->ops->close != NULL) {
+		xprt->ops->close(xprt);
+	}
+}
+
+/**
+\brief Set up a bus on an open serial port
+\param *bus Bus to initialize
+\param serial_fd File descriptor of the serial port
+\return 0 on success, -1 on failure
+
+The bus talks over a tty transport kept inside *bus, see
+amc_bus_new_transport.
+*/
+int amc_bus_new(struct amc_bus *bus, int serial_fd)
+{
+	assert(bus != NULL);
+	serial_port_transport(&bus->tty, serial_fd);
+	return amc_bus_new_transport(bus, &bus->tty);
+}
+
+/**
+\brief Set up a bus on a transport
+\param *bus Bus to initialize
+\param *xprt Transport of the line
+\return 0 on success, -1 on failure
+
+No memory is allocated. The transport remains owned by the caller and must
+outlive the bus. The baud rate is read back from the port for the wire
+time model when the transport has a file descriptor; set bus->baud for
+transports that do not.
+*/
+int amc_bus_new_transport(struct amc_bus *bus, struct amc_transport *xprt)
+{
+	assert(bus != NULL);
+	assert(xprt != NULL && xprt->ops != NULL);
+	bus->xprt = xprt;
+	bus->seq_ctr = 0;
+	bus->rx.head = bus->rx.tail = 0;
+	memset(&bus->stats, 0, sizeof(struct amc_stats));
+	bus->baud = (xprt->fd >= 0) ? serial_port_get_baud(xprt->fd) : 0;
+	return AMC_EOK;
+}
+
+/**
+\brief Release a bus
+\param *bus Bus initialized by amc_bus_new or amc_bus_new_transport
+
+Drives attached to the bus must not be used afterwards. The serial port
+or transport is not closed.
+*/
+void amc_bus_destroy(struct amc_bus *bus)
+{
+	assert(bus != NULL);
+	bus->xprt = NULL;
+}
+
+/**
+\brief Set up the per-drive state of a handle
+*/
+static void amc_drive_init(struct amc_drive *drv, struct amc_bus *bus, int address)
+{
+	drv->bus = bus;
+	drv->seq_ctr = bus->seq_ctr;
+	drv->address = address;
+	drv->timeout_us = AMC_DEFAULT_TIMEOUT_US;
+	drv->deadline_set = 0;
+	drv->rx_expect = -1;
+	drv->retry.max_retries = AMC_DEFAULT_MAX_RETRIES;
+	drv->retry.quiet_us = AMC_DEFAULT_QUIET_US;
+	drv->retry.drain_max_us = AMC_DEFAULT_DRAIN_MAX_US;
+	memset(&drv->latency, 0, sizeof(struct amc_latency));
+	drv->latency.guess_us = AMC_ADAPTIVE_INITIAL_US;
+	drv->adaptive_timeout = 1;
+	drv->wire_us = -1;
+}
+
+/**
+\brief Attach a drive handle to a bus
+\param *drv Drive handle to initialize
+\param *bus Bus the drive is on
+\param address Address of the drive, AMC_ADDR_MIN to AMC_ADDR_MAX
+\return 0 on success, -1 if the address is out of range
+
+Any number of handles can be attached to one bus. All of them draw
+sequence numbers from the bus and share its receive ring, so their
+transactions can follow each other on the line without the responses
+being mistaken for one another. Handles allocate nothing, and
+amc_drive_destroy leaves the bus alone. As before, only one thread may
+use a bus at a time.
+
+Adaptive timeouts are enabled (see amc_transaction_timeout_us).
+*/
+int amc_drive_attach(struct amc_drive *drv, struct amc_bus *bus, int address)
+{
+	assert(drv != NULL);
+	assert(bus != NULL && bus->xprt != NULL);
+	if (address < AMC_ADDR_MIN || address > AMC_ADDR_MAX) {
+		return -1;
+	}
+	amc_drive_init(drv, bus, address);
+	return AMC_EOK;
+}
+
 /**
 \brief Initialize a new AMC drive communications structure
 \param *drv Pointer to AMC drive structure
@@ -49,62 +311,309 @@ int amc_serial_open(char *dev, int spd)
 \param serial_fd File descriptor of open serial port
 \return 0 on success, -1 on failure
 
-Initialize a new AMC drive structure.
+Initialize a new AMC drive structure that talks to the drive over a tty
+transport kept inside *drv, on a bus of its own (see
+amc_drive_new_transport). Call amc_drive_destroy when the drive is no
+longer needed.
 */
 int amc_drive_new(struct amc_drive *drv, int address, int serial_fd)
 {
-	drv->device = serial_fd;
-	drv->crc_table = amc_crc_mktable(AMC_CRC_POLY);
-	drv->seq_ctr = 0;
-	drv->address = address;
-	drv->timeout_ms = AMC_DEFAULT_TIMEOUT_MS;
+	assert(drv != NULL);
+	amc_bus_new(&drv->own_bus, serial_fd);
+	amc_drive_init(drv, &drv->own_bus, address);
 	return AMC_EOK;
 }
 
 /**
-\brief Write an AMC command packet to the drive
-\param *drv AMC drive to write to
-\param *cmd Command packet header to write
+\brief Initialize a new AMC drive communications structure on a transport
+\param *drv Pointer to AMC drive structure
+\param address Address of the drive
+\param *xprt Transport the drive is reached over
+\return 0 on success, -1 on failure
+
+No memory is allocated: the drive gets a private bus kept inside *drv.
+Drives created this way each count sequence numbers
+on their own, so they must not share a line: to put several drives on one
+line, set up a struct amc_bus and use amc_drive_attach instead. The
+transport remains owned by the caller and must outlive the drive.
+*/
+int amc_drive_new_transport(struct amc_drive *drv, int address, struct amc_transport *xprt)
+{
+	assert(drv != NULL);
+	amc_bus_new_transport(&drv->own_bus, xprt);
+	amc_drive_init(drv, &drv->own_bus, address);
+	return AMC_EOK;
+}
+
+/**
+\brief Release an AMC drive communications structure
+\param *drv Pointer to AMC drive structure initialized by amc_drive_new,
+amc_drive_new_transport or amc_drive_attach
+
+Undoes amc_drive_new, amc_drive_new_transport or amc_drive_attach; a
+shared bus is left alone. The serial port or transport is not closed and
+the structure itself is not freed, both remain owned by the caller.
+*/
+void amc_drive_destroy(struct amc_drive *drv)
+{
+	assert(drv != NULL);
+	if (drv->bus == &drv->own_bus) {
+		amc_bus_destroy(&drv->own_bus);
+	}
+	drv->bus = NULL;
+}
+
+/**
+\brief Start the deadline of a transaction
+\param *drv AMC drive the transaction is with
+\param timeout_us Time allowed for the transaction, in microseconds
+
+The transaction must complete within timeout_us of this call, measured on
+CLOCK_MONOTONIC so that changes to the wall clock do not matter.
+*/
+static void amc_deadline_start(struct amc_drive *drv, int timeout_us)
+{
+	clock_gettime(CLOCK_MONOTONIC, &drv->sent);
+	drv->deadline = drv->sent;
+	drv->deadline.tv_sec += timeout_us / 1000000;
+	drv->deadline.tv_nsec += (timeout_us % 1000000) * 1000L;
+	if (drv->deadline.tv_nsec >= 1000000000L) {
+		drv->deadline.tv_sec++;
+		drv->deadline.tv_nsec -= 1000000000L;
+	}
+	drv->deadline_set = 1;
+}
+
+/**
+\brief Map a latency to its histogram bucket
+\param us Latency in microseconds
+*/
+static int amc_latency_bucket(unsigned int us)
+{
+	unsigned int v = us + 1;
+	int msb = 31 - __builtin_clz(v);
+	int idx = (msb < 2) ? v - 1 : 4 * msb + ((v >> (msb - 2)) & 3);
+
+	return (idx < AMC_LATENCY_BUCKETS) ? idx : AMC_LATENCY_BUCKETS - 1;
+}
+
+/**
+\brief Largest latency that falls into a histogram bucket
+\param idx Bucket index
+*/
+static unsigned int amc_latency_bucket_max(int idx)
+{
+	int msb = idx / 4;
+
+	if (idx < 3) {
+		return idx;
+	}
+	return ((4 + (idx & 3) + 1) << (msb - 2)) - 2;
+}
+
+/**
+\brief Add a turnaround latency sample
+\param *drv AMC drive the sample belongs to
+\param us Latency in microseconds
+*/
+static void amc_latency_add(struct amc_drive *drv, unsigned int us)
+{
+	struct amc_latency *lat = &drv->latency;
+	int idx;
+
+	if (lat->count >= AMC_LATENCY_WINDOW) {
+		lat->count = 0;
+		for (idx = 0; idx < AMC_LATENCY_BUCKETS; idx++) {
+			lat->bucket[idx] /= 2;
+			lat->count += lat->bucket[idx];
+		}
+	}
+	lat->bucket[amc_latency_bucket(us)]++;
+	lat->count++;
+}
+
+/**
+\brief Get a percentile of the drive's turnaround latency
+\param *drv AMC drive
+\param permille Percentile in tenths of a percent, eg: 999 for p99.9
+\return Latency in microseconds (rounded up to the histogram resolution of
+a quarter octave), or -1 if no samples have been taken yet
+
+Turnaround is the time the drive takes beyond the bytes on the wire: the
+full transaction time less amc_wire_time_us of the command and response.
+*/
+int amc_latency_percentile_us(const struct amc_drive *drv, int permille)
+{
+	const struct amc_latency *lat = &drv->latency;
+	unsigned long target, seen = 0;
+	int idx;
+
+	if (lat->count == 0) {
+		return -1;
+	}
+	target = ((unsigned long)lat->count * permille + 999) / 1000;
+	for (idx = 0; idx < AMC_LATENCY_BUCKETS; idx++) {
+		seen += lat->bucket[idx];
+		if (seen >= target) break;
+	}
+	return amc_latency_bucket_max((idx < AMC_LATENCY_BUCKETS) ? idx : AMC_LATENCY_BUCKETS - 1);
+}
+
+/**
+\brief Get the time a number of bytes spends on the wire
+\param *drv AMC drive, for the baud rate of its port
+\param bytes Number of bytes
+\return Time in microseconds at AMC_BITS_PER_BYTE bits per byte, 0 if the
+baud rate is unknown
+*/
+int amc_wire_time_us(const struct amc_drive *drv, int bytes)
+{
+	if (drv->bus->baud <= 0) {
+		return 0;
+	}
+	return ((long long)bytes * AMC_BITS_PER_BYTE * 1000000 + drv->bus->baud - 1) / drv->bus->baud;
+}
+
+/**
+\brief Widen a turnaround for the timeouts since the last response
+\param *drv AMC drive
+\param turnaround_us Turnaround to widen, in microseconds
+\return turnaround_us doubled for each timeout, at most drv->timeout_us
+*/
+static int amc_adaptive_backoff_us(const struct amc_drive *drv, int turnaround_us)
+{
+	long long turnaround = turnaround_us;
+	unsigned int ctr;
+
+	for (ctr = 0; ctr < drv->latency.backoff && turnaround < drv->timeout_us; ctr++) {
+		turnaround *= 2;
+	}
+	return (turnaround < drv->timeout_us) ? turnaround : drv->timeout_us;
+}
+
+/**
+\brief Work out the time to allow for a transaction
+\param *drv AMC drive the transaction is with
+\param cmd_bytes Bytes in the command frame
+\param resp_bytes Bytes in the expected response frame
+\return Timeout in microseconds
+
+With adaptive timeouts enabled, this is the wire time of command and
+response plus 1.5 times the p99.9 turnaround latency seen from this
+drive, plus AMC_ADAPTIVE_MARGIN_US for scheduling jitter. Until
+AMC_ADAPTIVE_MIN_SAMPLES transactions have completed the latency is
+assumed to be drv->latency.guess_us, at first AMC_ADAPTIVE_INITIAL_US,
+which covers the 16 ms latency timer of a stock USB-serial adapter; it is
+never tightened before then. Each response that times out or comes back
+out of sequence, to a read or a write, doubles the turnaround allowed
+until the drive answers again, so that a drive slower than expected is
+still heard from. Before there
+are enough samples, the guess it answered to is kept for its next
+transactions. The result never exceeds drv->timeout_us, which stays the
+hard upper bound. A drive that answers well after AMC_ADAPTIVE_INITIAL_US
+on its first transactions can leave each late answer to the next one;
+clear drv->adaptive_timeout for such drives.
+*/
+int amc_transaction_timeout_us(const struct amc_drive *drv, int cmd_bytes, int resp_bytes)
+{
+	long long timeout;
+	int turnaround;
+
+	if (!drv->adaptive_timeout) {
+		return drv->timeout_us;
+	}
+	turnaround = (drv->latency.count >= AMC_ADAPTIVE_MIN_SAMPLES) ?
+		amc_latency_percentile_us(drv, AMC_ADAPTIVE_PERMILLE) : drv->latency.guess_us;
+	turnaround = amc_adaptive_backoff_us(drv, turnaround);
+	timeout = amc_wire_time_us(drv, cmd_bytes + resp_bytes) +
+		turnaround + turnaround / 2 + AMC_ADAPTIVE_MARGIN_US;
+	return (timeout < drv->timeout_us) ? timeout : drv->timeout_us;
+}
+
+/**
+\brief Wait for the drive's port to become readable
+\param *drv AMC drive to wait on
+\return 1 if the port is readable, 0 if the transaction deadline has passed,
+-1 on error
+
+Waits on the transport for whatever time is left until the deadline, so
+the total time spent waiting across all phases of a response is bounded,
+however the bytes trickle in.
+*/
+static int amc_wait_readable(struct amc_drive *drv)
+{
+	struct timespec now, left;
+	int ret;
+
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		left.tv_sec = drv->deadline.tv_sec - now.tv_sec;
+		left.tv_nsec = drv->deadline.tv_nsec - now.tv_nsec;
+		if (left.tv_nsec < 0) {
+			left.tv_sec--;
+			left.tv_nsec += 1000000000L;
+		}
+		if (left.tv_sec < 0) {
+			return 0;
+		}
+		ret = drv->bus->xprt->ops->wait(drv->bus->xprt, &left);
+	} while ((ret == -1) && (errno == EINTR));
+
+	return ret;
+}
+
+/**
+\brief Note the response payload a command will produce
+\param *drv AMC drive the command is sent to
+\param *cmd Encoded command header
+
+Commands with read access make the drive send back payload_len words.
+amc_resp_read uses this to scatter the response straight into the
+caller's buffers. Sending a command also starts the transaction deadline,
+sized from the wire time of the frames and the drive's latency history.
+*/
+static void amc_expect_response(struct amc_drive *drv, const struct amc_command *cmd)
+{
+	int payload_bytes = cmd->payload_len * sizeof(uint16_t) + sizeof(uint16_t);
+	int cmd_bytes = sizeof(struct amc_command);
+	int resp_bytes = sizeof(struct amc_response);
+
+	drv->rx_expect = 0;
+	if (cmd->control.bits.cmd & AMC_CMDTYPE_READ) {
+		drv->rx_expect = cmd->payload_len * sizeof(uint16_t);
+		resp_bytes += payload_bytes;
+	}
+	if (cmd->control.bits.cmd & AMC_CMDTYPE_WRITE) {
+		cmd_bytes += payload_bytes;
+	}
+	drv->wire_us = amc_wire_time_us(drv, cmd_bytes + resp_bytes);
+	amc_deadline_start(drv, amc_transaction_timeout_us(drv, cmd_bytes, resp_bytes));
+}
+
+/**
+\brief Encode an AMC command packet without sending it
+\param *drv AMC drive the command is meant for
+\param *cmd Command packet header to fill in
 \param access_type One of AMC_CMDTYPE_* macros, defines read/write access type
 \param response_len Expected response length, in bytes
 \param *payload Payload to send as a part of command packet, can be NULL if payload_len is zero
 \param payload_len Length of payload in bytes to send with this command packet.
 Can be zero to indicate no payload
-\return Number of bytes written on success, negative error value on failure
-
-This function computes CRC and initializes an AMC command header packet
-and sends it to the drive. The index and offset fields are not
-modified, and the control.bits.cmd must be properly set. The function
-also sends the specified payload.
-
-Enabling the debug flag causes every byte sent to be printed in box 
-brackets.
-
-This function makes use of writev to implement write combining and
-minimize calls to the kernel.
+\param *payload_crc Location to store the payload CRC, in network byte
+ordering. Only written if payload_len is nonzero
+\return Number of bytes in the complete frame on success, negative error
+value on failure
 
-A simple error check would look for negative return values
+This function advances the drive's sequence number, fills in the command
+header and computes the header and payload CRCs. The index and offset
+fields are not modified. The frame on the wire is the header, followed by
+the payload and *payload_crc if payload_len is nonzero. No I/O is done.
 */
-int amc_cmd_write(struct amc_drive *drv, struct amc_command *cmd, int access_type, 
-	int response_len, uint16_t *payload, int payload_len)
+int amc_cmd_encode(struct amc_drive *drv, struct amc_command *cmd, int access_type,
+	int response_len, const void *payload, int payload_len, uint16_t *payload_crc)
 {
 	assert(drv != NULL);
 	assert(cmd != NULL);
-	
-	/* Increment command sequence number */	
-	drv->seq_ctr++;
-	if (drv->seq_ctr >= 16) drv->seq_ctr = 0;
-	
-	if (drv->debug) {
-		printf("write: seq = %d\n", drv->seq_ctr);
-	}
-	
-	uint8_t *buffer = (uint8_t *)cmd;
-	cmd->sof = AMC_SOF_BYTE;
-	cmd->control.bits.seq = drv->seq_ctr;
-	cmd->control.bits.rsvd = 0;
-	cmd->addr = drv->address;
-	cmd->control.bits.cmd = access_type;
 
 	switch (access_type) {
 	case AMC_CMDTYPE_READ:
@@ -118,68 +627,94 @@ int amc_cmd_write(struct amc_drive *drv, struct amc_command *cmd, int access_typ
 		return AMC_EINVALIDACCESSTYPE;
 	}
 
-	/* Ensure that the CRC field is zero, since it is used as an accumulator */
-	cmd->crc = 0;
-	/* Number of words to check is one less than number of words in the header.
+	/* Increment command sequence number, shared by all drives on the bus */	
+	drv->bus->seq_ctr++;
+	if (drv->bus->seq_ctr >= 16) drv->bus->seq_ctr = 0;
+	drv->seq_ctr = drv->bus->seq_ctr;
+	
+	if (drv->debug) {
+		printf("write: seq = %d\n", drv->seq_ctr);
+	}
+	
+	cmd->sof = AMC_SOF_BYTE;
+	cmd->control.bits.seq = drv->seq_ctr;
+	cmd->control.bits.rsvd = 0;
+	cmd->addr = drv->address;
+	cmd->control.bits.cmd = access_type;
+
+	/* Number of bytes to check is the header size less the CRC field.
 	This assumes that the CRC is 16-bits and is always stored at the end of the
 	buffer */
-	int ctr;
 	int bytes_to_check = sizeof(struct amc_command) - sizeof(uint16_t);
 	
-	for (ctr = 0; ctr < bytes_to_check; ctr++) {
-		amc_crc_check_word(*(buffer + ctr), &cmd->crc, drv->crc_table);
+	/* CRC is always sent in big-endian (network) byte ordering, convert as necessary */	
+	cmd->crc = htons(amc_crc_update(0, cmd, bytes_to_check));
+	amc_expect_response(drv, cmd);
+
+	if (payload_len > 0) {
+		assert(payload != NULL);
+		assert(payload_crc != NULL);
+		*payload_crc = htons(amc_crc_update(0, payload, payload_len));
+		return sizeof(struct amc_command) + payload_len + sizeof(uint16_t);
 	}
+	return sizeof(struct amc_command);
+}
 
-	int bytes_to_write = sizeof(struct amc_command);
-	/* CRC is always sent in big-endian (network) byte ordering, convert as necessary */	
-	cmd->crc = htons(cmd->crc);
-	
-	/* Ensure that the CRC accumulator is zero */
-	uint16_t payload_crc = 0;
-	
+/**
+\brief Print every byte of a command frame in box brackets
+\param *iov Frame to print, as passed to writev
+\param iovcnt Number of entries in *iov
+*/
+static void amc_cmd_dump(const struct iovec *iov, int iovcnt)
+{
+	int ctr, part;
+
+	for (part = 0; part < iovcnt; part++) {
+		const uint8_t *buffer = (const uint8_t *)iov[part].iov_base;
+		for (ctr = 0; ctr < iov[part].iov_len; ctr++) {
+			printf("[%02X]", *(buffer + ctr));
+		}
+	}
+	printf("\n");
+}
+
+/**
+\brief Send an encoded command frame
+\param *drv AMC drive to write to
+\param *cmd Encoded command header
+\param *payload Payload, can be NULL if payload_len is zero
+\param payload_len Length of payload in bytes
+\param payload_crc Payload CRC, in network byte ordering
+\return Number of bytes written on success, AMC_EWRITE on failure
+*/
+static int amc_cmd_send(struct amc_drive *drv, const struct amc_command *cmd,
+	const void *payload, int payload_len, uint16_t payload_crc)
+{
 	struct iovec iov[3];
-	iov[0].iov_base = cmd;
+	int bytes_to_write = sizeof(struct amc_command);
+
+	iov[0].iov_base = (void *)cmd;
 	iov[0].iov_len = sizeof(struct amc_command);
 
 	if (payload_len > 0) {
-		bytes_to_check = payload_len;
-		buffer = (uint8_t *)payload;
-	
-		for (ctr = 0; ctr < bytes_to_check; ctr++) {
-			amc_crc_check_word(*(buffer + ctr), &payload_crc, drv->crc_table);
-		}
-		payload_crc = htons(payload_crc);	
-		iov[1].iov_base = payload;
+		iov[1].iov_base = (void *)payload;
 		iov[1].iov_len = payload_len;
 		iov[2].iov_base = &payload_crc;
 		iov[2].iov_len = sizeof(uint16_t);
+		bytes_to_write += payload_len + sizeof(uint16_t);
 	}
 
 	if (drv->debug) {
-		int ctr;
-		buffer = (uint8_t *)iov[0].iov_base;
-		for (ctr = 0; ctr < iov[0].iov_len; ctr++) {
-			printf("[%02X]", *(buffer + ctr));
-		}
-		if (payload_len > 0) {
-			buffer = (uint8_t *)iov[1].iov_base;
-			for (ctr = 0; ctr < iov[1].iov_len; ctr++) {
-				printf("[%02X]", *(buffer + ctr));
-			}
-			buffer = (uint8_t *)iov[2].iov_base;
-			for (ctr = 0; ctr < iov[2].iov_len; ctr++) {
-				printf("[%02X]", *(buffer + ctr));
-			}
-		}
-		printf("\n");
+		amc_cmd_dump(iov, (payload_len > 0) ? 3 : 1);
 	}
 	
-	bytes_to_write = 0;
-	for (ctr = 0; ctr < ((payload_len > 0) ? 3 : 1); ctr++) {
-		bytes_to_write += iov[ctr].iov_len;
-	} 
-	int bytes_written = writev(drv->device, iov, (payload_len > 0) ? 3 : 1);
+	drv->bus->xprt->deadline = drv->deadline_set ? &drv->deadline : NULL;
+	int bytes_written = drv->bus->xprt->ops->writev(drv->bus->xprt, iov, (payload_len > 0) ? 3 : 1);
+	drv->bus->xprt->deadline = NULL;
 
+	if (bytes_written == -1 && errno == ETIMEDOUT) {
+		return AMC_ETIMEOUT;
+	}
 	if (bytes_written != bytes_to_write) {
 		return AMC_EWRITE;
 	}
@@ -188,82 +723,316 @@ int amc_cmd_write(struct amc_drive *drv, struct amc_command *cmd, int access_typ
 }
 
 /**
-\brief Read back a response from the drive
-\param *drv AMC drive to read
-\param *cmd Location to store data read back from drive
-\param *payload Location to store paylaod read back from drive (if any)
-\param payload_max_size Max. size in bytes of buffer pointed to by *payload
-\return Number of bytes read on success, -1 on failure
+\brief Write an AMC command packet to the drive
+\param *drv AMC drive to write to
+\param *cmd Command packet header to write
+\param access_type One of AMC_CMDTYPE_* macros, defines read/write access type
+\param response_len Expected response length, in bytes
+\param *payload Payload to send as a part of command packet, can be NULL if payload_len is zero
+\param payload_len Length of payload in bytes to send with this command packet.
+Can be zero to indicate no payload
+\return Number of bytes written on success, negative error value on failure
 
-This function reads back a response from the drive. It first reads in a
-response header, then uses the contents of the response header to determine
-how many words (if any) exist in the payload and reads these words back.
-If any reads time out, an error is returned back to the caller.
-If either the response header or the payload CRCs do not match, an error
-is returned back to the caller.
+This function computes CRC and initializes an AMC command header packet
+and sends it to the drive. The index and offset fields are not
+modified, and the control.bits.cmd must be properly set. The function
+also sends the specified payload.
 
-Enabling the debug flag causes every byte received to be printed out in
-angle brackets, and errors to be printed out.
+Enabling the debug flag causes every byte sent to be printed in box 
+brackets.
+
+This function makes use of writev to implement write combining and
+minimize calls to the kernel.
+
+A simple error check would look for negative return values
 */
-int amc_resp_read(struct amc_drive *drv, struct amc_response *rsp, void *payload, int payload_max_size)
+int amc_cmd_write(struct amc_drive *drv, struct amc_command *cmd, int access_type, 
+	int response_len, uint16_t *payload, int payload_len)
 {
-	uint8_t *rd_ptr;
+	uint16_t payload_crc = 0;
+	int ret = amc_cmd_encode(drv, cmd, access_type, response_len,
+		payload, payload_len, &payload_crc);
 
-	struct pollfd pfd;
+	if (ret < 0) {
+		return ret;
+	}
+	return amc_cmd_send(drv, cmd, payload, payload_len, payload_crc);
+}
 
-	rd_ptr = (uint8_t *)rsp;
-	int bytes_to_read = sizeof(struct amc_response);
-	int total_bytes_read = 0;
+/**
+\brief Check whether two drives are reached over the same port
+\param *a First drive
+\param *b Second drive
+\return Nonzero if both drives share a port
 
-	int ret;
-	pfd.fd = drv->device;
-	pfd.events = POLLIN;
-	pfd.revents = 0;
+Drives created with amc_drive_new each have a bus and transport of their
+own, so transports of the same kind on the same file descriptor count as
+one port.
+*/
+static int amc_same_port(const struct amc_drive *a, const struct amc_drive *b)
+{
+	const struct amc_transport *xa = a->bus->xprt, *xb = b->bus->xprt;
 
-	do {
-		do {
-			ret = poll(&pfd, 1, drv->timeout_ms);
-		} while ((ret == -1) && (errno == EINTR));
+	if (a->bus == b->bus || xa == xb) {
+		return 1;
+	}
+	return (xa->fd >= 0) && (xa->fd == xb->fd) && (xa->ops == xb->ops);
+}
 
-		if (ret == 0) {
-			if (drv->debug) {
-				printf("Timed out reading response header\n");
+/**
+\brief Write several AMC command packets with a single system call
+\param *batch Array of commands to send. For each entry, drv, cmd.index,
+cmd.offset, access_type, response_len, payload and payload_len are set as
+for amc_cmd_write
+\param count Number of entries in *batch
+\return Number of commands written completely, or a negative error value
+if nothing could be written
+
+Encodes every command, then sends all of them back to back with one
+writev (split only if the batch exceeds IOV_MAX). All drives must share
+the same port as the first one, others fail with AMC_EPORT. The outcome of each command is stored in its result
+field: the number of bytes written, or a negative error value if the
+command could not be encoded or was not completely written. Commands are
+sent in array order and sequence numbers are drawn as by amc_cmd_write,
+so responses are read back with amc_resp_read as usual.
+
+It is up to the caller to make sure the responses cannot collide on the
+bus, for example by only batching writes whose acknowledgements are
+shorter than the commands that follow them.
+*/
+int amc_cmd_write_batch(struct amc_cmd_batch *batch, int count)
+{
+	struct iovec iov[AMC_BATCH_IOV_MAX];
+	int first, last, ctr, written = 0;
+	struct amc_transport *xprt;
+
+	assert(batch != NULL || count == 0);
+	if (count <= 0) {
+		return 0;
+	}
+	xprt = batch[0].drv->bus->xprt;
+
+	for (ctr = 0; ctr < count; ctr++) {
+		struct amc_cmd_batch *b = &batch[ctr];
+		assert(b->drv != NULL);
+		if (!amc_same_port(b->drv, batch[0].drv)) {
+			b->result = AMC_EPORT;
+			continue;
+		}
+		b->result = amc_cmd_encode(b->drv, &b->cmd, b->access_type, b->response_len,
+			b->payload, b->payload_len, &b->payload_crc);
+		if (b->drv->debug && b->result > 0) {
+			struct iovec frame[3] = {
+				{ &b->cmd, sizeof(struct amc_command) },
+				{ (void *)b->payload, b->payload_len },
+				{ &b->payload_crc, sizeof(uint16_t) }
+			};
+			amc_cmd_dump(frame, (b->payload_len > 0) ? 3 : 1);
+		}
+		/* The whole batch is written within the first command's deadline */
+		if (xprt->deadline == NULL && b->result > 0 && b->drv->deadline_set) {
+			xprt->deadline = &b->drv->deadline;
+		}
+	}
+
+	for (first = 0; first < count; first = last) {
+		int iovcnt = 0, bytes_to_write = 0, bytes_written;
+		int iov_pos = 0;
+
+		/* Gather as many encoded frames as fit in one writev */
+		for (last = first; last < count; last++) {
+			struct amc_cmd_batch *b = &batch[last];
+			if (b->result < 0) continue;
+			if (iovcnt + 3 > AMC_BATCH_IOV_MAX) break;
+			iov[iovcnt].iov_base = &b->cmd;
+			iov[iovcnt++].iov_len = sizeof(struct amc_command);
+			if (b->payload_len > 0) {
+				iov[iovcnt].iov_base = (void *)b->payload;
+				iov[iovcnt++].iov_len = b->payload_len;
+				iov[iovcnt].iov_base = &b->payload_crc;
+				iov[iovcnt++].iov_len = sizeof(uint16_t);
 			}
-			return AMC_ETIMEOUT;
+			bytes_to_write += b->result;
 		}
-	
-		int bytes_read = read(drv->device, rd_ptr, bytes_to_read);
-		rd_ptr += bytes_read;
-		bytes_to_read -= bytes_read;
-		total_bytes_read += bytes_read;
-	} while (bytes_to_read > 0);
-	
+
+		/* Keep writing until the kernel has taken everything, advancing
+		past whatever a short write already sent */
+		while (bytes_to_write > 0) {
+			do {
+				bytes_written = xprt->ops->writev(xprt, &iov[iov_pos], iovcnt - iov_pos);
+			} while ((bytes_written == -1) && (errno == EINTR));
+			if (bytes_written <= 0) {
+				break;
+			}
+			bytes_to_write -= bytes_written;
+			while (iov_pos < iovcnt && bytes_written >= iov[iov_pos].iov_len) {
+				bytes_written -= iov[iov_pos++].iov_len;
+			}
+			if (bytes_written > 0) {
+				iov[iov_pos].iov_base = (uint8_t *)iov[iov_pos].iov_base + bytes_written;
+				iov[iov_pos].iov_len -= bytes_written;
+			}
+		}
+
+		if (bytes_to_write > 0) {
+			/* Frames that were not completely sent are failures. Work back
+			from the end of this chunk, the unsent bytes are always at the tail */
+			int ctr;
+			for (ctr = last - 1; ctr >= first && bytes_to_write > 0; ctr--) {
+				if (batch[ctr].result < 0) continue;
+				bytes_to_write -= batch[ctr].result;
+				batch[ctr].result = AMC_EWRITE;
+			}
+			for (ctr = last; ctr < count; ctr++) {
+				if (batch[ctr].result >= 0) batch[ctr].result = AMC_EWRITE;
+			}
+			break;
+		}
+	}
+	xprt->deadline = NULL;
+
+	for (ctr = 0; ctr < count; ctr++) {
+		if (batch[ctr].result > 0) written++;
+	}
+	return (written == 0) ? AMC_EWRITE : written;
+}
+
+/**
+\brief Prepare a frame template for a command that is sent repeatedly
+\param *tpl Template to initialize
+\param *drv AMC drive the command will be sent to
+\param index Index of the parameter
+\param offset Offset of the parameter
+\param access_type One of AMC_CMDTYPE_* macros, defines read/write access type
+\param len Payload length in bytes. For AMC_CMDTYPE_READ this is the expected
+response length, otherwise it is the length of the payload that will be sent
+\return AMC_EOK on success, negative error value on failure
+
+The header is built and its CRC computed once for each of the 16 sequence
+numbers, so sending the command with amc_cmd_write_template only has to
+pick the header that matches the next sequence number. Only the payload
+CRC (if any) is computed per frame.
+*/
+int amc_frame_template_init(struct amc_frame_template *tpl, struct amc_drive *drv,
+	int index, int offset, int access_type, int len)
+{
+	int seq;
+
+	assert(tpl != NULL);
+	assert(drv != NULL);
+
+	switch (access_type) {
+	case AMC_CMDTYPE_READ:
+		tpl->payload_len = 0;
+		break;
+	case AMC_CMDTYPE_WRITE:
+	case AMC_CMDTYPE_READWRITE:
+		tpl->payload_len = len;
+		break;
+	default:
+		return AMC_EINVALIDACCESSTYPE;
+	}
+
+	for (seq = 0; seq < 16; seq++) {
+		struct amc_command *cmd = &tpl->hdr[seq];
+		cmd->sof = AMC_SOF_BYTE;
+		cmd->addr = drv->address;
+		cmd->control.byte = 0;
+		cmd->control.bits.cmd = access_type;
+		cmd->control.bits.seq = seq;
+		cmd->index = index;
+		cmd->offset = offset;
+		cmd->payload_len = len / sizeof(uint16_t);
+		cmd->crc = htons(amc_crc_update(0, cmd, sizeof(struct amc_command) - sizeof(uint16_t)));
+	}
+	return AMC_EOK;
+}
+
+/**
+\brief Encode a command from a frame template without sending it
+\param *drv AMC drive the command is meant for
+\param *tpl Template prepared with amc_frame_template_init for this drive
+\param *payload Payload to send, tpl->payload_len bytes long. Ignored if the
+template has no payload
+\param **cmd Location to store a pointer to the header to send
+\param *payload_crc Location to store the payload CRC, in network byte
+ordering. Only written if the template has a payload
+\return Number of bytes in the complete frame
+
+Advances the drive's sequence number like amc_cmd_encode. No I/O is done.
+*/
+int amc_cmd_encode_template(struct amc_drive *drv, const struct amc_frame_template *tpl,
+	const void *payload, const struct amc_command **cmd, uint16_t *payload_crc)
+{
+	assert(drv != NULL);
+	assert(tpl != NULL);
+	assert(tpl->hdr[0].addr == drv->address);
+
+	/* Increment command sequence number, shared by all drives on the bus */
+	drv->bus->seq_ctr++;
+	if (drv->bus->seq_ctr >= 16) drv->bus->seq_ctr = 0;
+	drv->seq_ctr = drv->bus->seq_ctr;
+
 	if (drv->debug) {
-		printf("read: seq = %d\n", (int)rsp->control.bits.seq);
+		printf("write: seq = %d\n", drv->seq_ctr);
 	}
-	
+
+	*cmd = &tpl->hdr[drv->seq_ctr];
+	amc_expect_response(drv, *cmd);
+	if (tpl->payload_len > 0) {
+		assert(payload != NULL);
+		*payload_crc = htons(amc_crc_update(0, payload, tpl->payload_len));
+		return sizeof(struct amc_command) + tpl->payload_len + sizeof(uint16_t);
+	}
+	return sizeof(struct amc_command);
+}
+
+/**
+\brief Write a command prepared as a frame template to the drive
+\param *drv AMC drive to write to
+\param *tpl Template prepared with amc_frame_template_init for this drive
+\param *payload Payload to send, tpl->payload_len bytes long. Can be NULL if
+the template has no payload
+\return Number of bytes written on success, negative error value on failure
+
+Equivalent to amc_cmd_write with the parameters given to
+amc_frame_template_init, but without rebuilding the header. Read the
+response back with amc_resp_read as usual.
+*/
+int amc_cmd_write_template(struct amc_drive *drv, const struct amc_frame_template *tpl,
+	const void *payload)
+{
+	const struct amc_command *cmd;
+	uint16_t payload_crc = 0;
+
+	amc_cmd_encode_template(drv, tpl, payload, &cmd, &payload_crc);
+	return amc_cmd_send(drv, cmd, payload, tpl->payload_len, payload_crc);
+}
+
+/**
+\brief Check a response header received from the drive
+\param *drv AMC drive the response came from
+\param *rsp Response header as received
+\return AMC_EOK if the header is valid and reports success, negative error
+value otherwise
+
+Verifies the sequence number against the last command sent to the drive,
+the header CRC and the status byte. No I/O is done.
+*/
+int amc_resp_check_header(struct amc_drive *drv, const struct amc_response *rsp)
+{
+	int bytes_to_check = sizeof(struct amc_response) - sizeof(uint16_t);
+	uint16_t crc;
+
 	if (rsp->control.bits.seq != drv->seq_ctr) {
 		if (drv->debug) {
 			printf("Sequence error (expected %2d, got %2d)\n", (int)drv->seq_ctr, (int)rsp->control.bits.seq);
 		}
-		return AMC_ESEQ;
-	}
-	
-	uint8_t *buffer = (uint8_t *)rsp;
-	int bytes_to_check = sizeof(struct amc_response) - sizeof(uint16_t);
-	uint16_t crc, ctr;
-	
-	crc = 0;
-	
-	if (drv->debug) {
-		for (ctr = 0; ctr < total_bytes_read; ctr++) {
-			printf("<%02X>", *(buffer + ctr));
-		}
-	}
-	for (ctr = 0; ctr < bytes_to_check; ctr++) {
-		amc_crc_check_word(*(buffer + ctr), &crc, drv->crc_table);
+		return AMC_ESEQ;
 	}
 	
+	crc = amc_crc_update(0, rsp, bytes_to_check);
+	
 	/* Convert received CRC back to host byte ordering */
 	if (crc != ntohs(rsp->crc)) {
 		if (drv->debug) {
@@ -297,96 +1066,656 @@ int amc_resp_read(struct amc_drive *drv, struct amc_response *rsp, void *payload
 		}
 		return AMC_EUNKNOWNSTATUS;
 	}
+	return AMC_EOK;
+}
 
-	/* Check if the drive will send a payload with this data */
-	if (!(rsp->control.bits.cmd & 0x02)) {
-		return total_bytes_read;
-	}
+/**
+\brief Check a response payload received from the drive
+\param *drv AMC drive the response came from
+\param *rsp Response header, already checked with amc_resp_check_header
+\param *payload Payload as received, rsp->payload_len words long
+\param payload_crc Payload CRC as received, in network byte ordering
+\return AMC_EOK if the payload CRC matches, AMC_ECRC otherwise
+*/
+int amc_resp_check_payload(struct amc_drive *drv, const struct amc_response *rsp,
+	const void *payload, uint16_t payload_crc)
+{
+	uint16_t crc = amc_crc_update(0, payload, rsp->payload_len * sizeof(uint16_t));
 	
-	assert(payload != NULL);
+	/* Convert received CRC back to host byte ordering */
+	if (crc != ntohs(payload_crc)) {
+		if (drv->debug) {
+			printf("CRC failed (expected %04X, got %04X)\n", crc, ntohs(payload_crc));
+		}
+		return AMC_ECRC;
+	}
+	return AMC_EOK;
+}
 
-	rd_ptr = (uint8_t *)payload;
-	bytes_to_read = rsp->payload_len * sizeof(uint16_t);
-	int payload_bytes_read = 0;
+/**
+\brief Read everything the port has available into the receive ring
+\param *drv AMC drive whose port is read
+\return Number of bytes read, 0 if the ring is full, negative on error
+
+Fills all free space in the ring with a single readv, the free space may
+wrap around the end of the ring.
+*/
+static int amc_rx_fill(struct amc_drive *drv)
+{
+	struct amc_rxbuf *rx = &drv->bus->rx;
+	unsigned int space = AMC_RXBUF_SIZE - (rx->tail - rx->head);
+	unsigned int pos = rx->tail & (AMC_RXBUF_SIZE - 1);
+	struct iovec iov[2];
+	int iovcnt = 1, bytes_read;
+
+	if (space == 0) {
+		return 0;
+	}
+	iov[0].iov_base = rx->data + pos;
+	iov[0].iov_len = (space < AMC_RXBUF_SIZE - pos) ? space : AMC_RXBUF_SIZE - pos;
+	if (iov[0].iov_len < space) {
+		iov[1].iov_base = rx->data;
+		iov[1].iov_len = space - iov[0].iov_len;
+		iovcnt = 2;
+	}
 
 	do {
-		do {
-			ret = poll(&pfd, 1, drv->timeout_ms);
-		} while ((ret == -1) && (errno == EINTR));
+		bytes_read = drv->bus->xprt->ops->readv(drv->bus->xprt, iov, iovcnt);
+	} while ((bytes_read == -1) && (errno == EINTR));
 
-		if (ret == 0) {
-			if (drv->debug) {
-				printf("Timed out reading payload\n");
+	if (bytes_read > 0) {
+		rx->tail += bytes_read;
+	}
+	return bytes_read;
+}
+
+/**
+\brief Feed buffered bytes to a response decoder
+\param *drv AMC drive whose receive ring is drained
+\param *parser Decoder to feed
+\return Result of the last amc_parser_push, 0 if the ring ran empty
+
+Stops as soon as the decoder completes (or rejects) a frame, so bytes of
+any later frame stay in the ring for the next call.
+*/
+static int amc_rx_decode(struct amc_drive *drv, struct amc_parser *parser)
+{
+	struct amc_rxbuf *rx = &drv->bus->rx;
+	int ret = 0;
+
+	while (ret == 0 && rx->tail != rx->head) {
+		unsigned int pos = rx->head & (AMC_RXBUF_SIZE - 1);
+		unsigned int len = rx->tail - rx->head;
+		int used, ctr;
+
+		if (len > AMC_RXBUF_SIZE - pos) {
+			len = AMC_RXBUF_SIZE - pos;
+		}
+		ret = amc_parser_push(parser, rx->data + pos, len, &used);
+		if (drv->debug) {
+			for (ctr = 0; ctr < used; ctr++) {
+				printf("<%02X>", rx->data[pos + ctr]);
 			}
-			return AMC_ETIMEOUT;
 		}
-	
-		int bytes_read = read(drv->device, rd_ptr, bytes_to_read);
-		rd_ptr += bytes_read;
-		bytes_to_read -= bytes_read;
-		payload_bytes_read += bytes_read;
+		rx->head += used;
+	}
+	return ret;
+}
+
+/**
+\brief Throw away bytes of the response being read
+\param *drv AMC drive whose receive ring is drained
+\param count Number of bytes to throw away, from the ring and then the port
+\return AMC_EOK, or a negative error value if the bytes did not arrive
+before the transaction deadline
+*/
+static int amc_rx_skip(struct amc_drive *drv, int count)
+{
+	struct amc_rxbuf *rx = &drv->bus->rx;
+	unsigned int len;
+	int ret;
+
+	while (count > 0) {
+		if (rx->tail == rx->head) {
+			ret = amc_wait_readable(drv);
+			if (ret <= 0) {
+				return (ret == 0) ? AMC_ETIMEOUT : AMC_EREAD;
+			}
+			if (amc_rx_fill(drv) <= 0) {
+				return AMC_EREAD;
+			}
+		}
+		len = rx->tail - rx->head;
+		if (len > count) {
+			len = count;
+		}
+		rx->head += len;
+		count -= len;
+	}
+	return AMC_EOK;
+}
+
+/**
+\brief Read a response of known length straight into the caller's buffers
+\param *drv AMC drive to read, with an empty receive ring
+\param *rsp Location to store the response header
+\param *payload Location to store the payload
+\param payload_max_size Max. size in bytes of buffer pointed to by *payload
+\return Number of header and payload bytes read on success, negative error
+value on failure, or 0 if the response is not the one expected. In that
+case every byte read so far has been moved to the receive ring
+
+Scatters the header, payload and payload CRC into *rsp, *payload and a
+CRC slot with readv, asking for exactly the length announced by the last
+command, so no bounce buffer is needed and nothing past the response is
+consumed. The expected length is checked against payload_max_size before
+anything is read. The header is checked as soon as it is complete. If it
+is damaged, reports an error or announces a different payload, the bytes
+are handed over to the ring and decoder, which know how to deal with them.
+*/
+static int amc_resp_read_direct(struct amc_drive *drv, struct amc_response *rsp,
+	void *payload, int payload_max_size)
+{
+	int expect = drv->rx_expect;
+	uint16_t payload_crc;
+	struct iovec iov[3], *cur = iov;
+	int iovcnt = 1, total = 0, header_ok = 0;
+	int frame_len = sizeof(struct amc_response);
+	int ret, ctr;
+
+	/* The decoder rejects the payload and skips it, so that it is not
+	mistaken for the next response */
+	if (expect > 0 && (payload == NULL || expect > payload_max_size)) {
+		if (drv->debug) {
+			printf("Expected payload of %d bytes exceeds max size\n", expect);
+		}
+		return 0;
+	}
+
+	iov[0].iov_base = rsp;
+	iov[0].iov_len = sizeof(struct amc_response);
+	if (expect > 0) {
+		iov[1].iov_base = payload;
+		iov[1].iov_len = expect;
+		iov[2].iov_base = &payload_crc;
+		iov[2].iov_len = sizeof(uint16_t);
+		iovcnt = 3;
+		frame_len += expect + sizeof(uint16_t);
+	}
 
-		if (payload_bytes_read > payload_max_size) {
+	while (total < frame_len) {
+		int bytes_read;
+
+		ret = amc_wait_readable(drv);
+		if (ret <= 0) {
 			if (drv->debug) {
-				printf("Payload received exceeds max size\n");
+				printf("Timed out reading response (%d bytes missing)\n", frame_len - total);
+			}
+			return (ret == 0) ? AMC_ETIMEOUT : AMC_EREAD;
+		}
+
+		do {
+			bytes_read = drv->bus->xprt->ops->readv(drv->bus->xprt, cur, iovcnt - (cur - iov));
+		} while ((bytes_read == -1) && (errno == EINTR));
+		if (bytes_read <= 0) {
+			return AMC_EREAD;
+		}
+		total += bytes_read;
+
+		/* Step over the iovecs that were filled */
+		while (bytes_read > 0 && bytes_read >= cur->iov_len) {
+			bytes_read -= cur->iov_len;
+			cur++;
+		}
+		if (bytes_read > 0) {
+			cur->iov_base = (uint8_t *)cur->iov_base + bytes_read;
+			cur->iov_len -= bytes_read;
+		}
+
+		if (!header_ok && total >= sizeof(struct amc_response)) {
+			int has_payload = (rsp->status1 == AMC_CMDRESP_COMPLETE) &&
+				(rsp->control.bits.cmd & 0x02);
+
+			header_ok = (rsp->sof == AMC_SOF_BYTE) &&
+				(amc_crc_update(0, rsp, sizeof(struct amc_response) - sizeof(uint16_t)) == ntohs(rsp->crc)) &&
+				(has_payload ? rsp->payload_len * sizeof(uint16_t) == expect : expect == 0);
+
+			if (!header_ok) {
+				/* Not what was asked for, let the decoder sort it out */
+				struct amc_rxbuf *rx = &drv->bus->rx;
+				int part, copied = 0;
+				for (part = 0; part < iovcnt && copied < total; part++) {
+					int len = (part == 0) ? sizeof(struct amc_response) :
+						(part == 1) ? expect : sizeof(uint16_t);
+					uint8_t *base = (part == 0) ? (uint8_t *)rsp :
+						(part == 1) ? (uint8_t *)payload : (uint8_t *)&payload_crc;
+					if (len > total - copied) len = total - copied;
+					memcpy(rx->data + copied, base, len);
+					copied += len;
+				}
+				rx->head = 0;
+				rx->tail = copied;
+				return 0;
 			}
-			return AMC_EBUFSIZE;
 		}
-	} while (bytes_to_read > 0);
-	total_bytes_read += payload_bytes_read;
+	}
 
 	if (drv->debug) {
-		buffer = (uint8_t *)payload;
-		for (ctr = 0; ctr < payload_bytes_read; ctr++) {
-			printf("<%02X>", *(buffer + ctr));
+		for (ctr = 0; ctr < sizeof(struct amc_response); ctr++) {
+			printf("<%02X>", ((uint8_t *)rsp)[ctr]);
+		}
+		for (ctr = 0; ctr < expect; ctr++) {
+			printf("<%02X>", ((uint8_t *)payload)[ctr]);
 		}
+		if (expect > 0) {
+			printf("<%02X><%02X>", ((uint8_t *)&payload_crc)[0], ((uint8_t *)&payload_crc)[1]);
+		}
+		printf("\nread: seq = %d\n", (int)rsp->control.bits.seq);
 	}
 
-	uint16_t readback_crc = 0;
-	rd_ptr = (uint8_t *)&readback_crc;
-	bytes_to_read = sizeof(uint16_t);
-	do {
-		do {
-			ret = poll(&pfd, 1, drv->timeout_ms);
-		} while ((ret == -1) && (errno == EINTR));
+	if (expect > 0 && amc_crc_update(0, payload, expect) != ntohs(payload_crc)) {
+		if (drv->debug) {
+			printf("Payload CRC failed\n");
+		}
+		return AMC_ECRC;
+	}
+
+	ret = amc_resp_check_header(drv, rsp);
+	if (ret != AMC_EOK) {
+		return ret;
+	}
+	return sizeof(struct amc_response) + expect;
+}
+
+/**
+\brief Read a response through the receive ring and decoder
+\param *drv AMC drive to read
+\param *rsp Location to store the response header
+\param *payload Location to store the payload
+\param payload_max_size Max. size in bytes of buffer pointed to by *payload
+\return As for amc_resp_read
+*/
+static int amc_resp_read_ring(struct amc_drive *drv, struct amc_response *rsp,
+	void *payload, int payload_max_size)
+{
+	struct amc_parser parser;
+	int ret;
 
-		if (ret == 0) {
+	amc_parser_init(&parser);
+	amc_parser_set_payload(&parser, payload, (payload != NULL) ? payload_max_size : 0);
+
+	while (0 == (ret = amc_rx_decode(drv, &parser))) {
+		ret = amc_wait_readable(drv);
+		if (ret <= 0) {
 			if (drv->debug) {
-				printf("Timed out reading payload CRC\n");
+				printf("Timed out reading response (%d bytes missing)\n", amc_parser_wanted(&parser));
 			}
-			return AMC_ECRC;
+			return (ret == 0) ? AMC_ETIMEOUT : AMC_EREAD;
 		}
-		int bytes_read = read(drv->device, rd_ptr, bytes_to_read);
-		rd_ptr += bytes_read;
-		bytes_to_read -= bytes_read;
-		payload_bytes_read += bytes_read;
-	} while (bytes_to_read > 0);
-	
+
+		if (amc_rx_fill(drv) <= 0) {
+			return AMC_EREAD;
+		}
+	}
+
+	if (ret == AMC_EBUFSIZE) {
+		/* Skip the rest of the rejected payload and its CRC. Whatever
+		does not arrive in time is left to the recovery drain */
+		if (drv->debug) {
+			printf("Payload received exceeds max size\n");
+		}
+		amc_rx_skip(drv, amc_parser_wanted(&parser));
+	}
+	if (ret == AMC_ECRC && drv->debug) {
+		printf("Payload CRC failed\n");
+	}
+	if (drv->debug) {
+		printf("\nread: seq = %d\n", (int)parser.rsp.control.bits.seq);
+	}
+	*rsp = parser.rsp;
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = amc_resp_check_header(drv, rsp);
+	if (ret != AMC_EOK) {
+		return ret;
+	}
+
+	return sizeof(struct amc_response) + parser.payload_size;
+}
+
+/**
+\brief Update the drive statistics with the outcome of a response read
+\param *drv AMC drive the response was read from
+\param ret Return value of the read
+
+Successful transactions started by a command also feed the turnaround
+latency histogram. Timeouts and responses out of sequence widen the
+turnaround allowed for the next attempt or transaction, see
+amc_transaction_timeout_us.
+*/
+void amc_count_result(struct amc_drive *drv, int ret)
+{
+	drv->bus->stats.transactions++;
+	if (ret >= 0 && drv->wire_us >= 0) {
+		struct timespec now;
+		long long us;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		us = (now.tv_sec - drv->sent.tv_sec) * 1000000LL +
+			(now.tv_nsec - drv->sent.tv_nsec) / 1000 - drv->wire_us;
+		amc_latency_add(drv, (us > 0) ? us : 0);
+		/* A wider guess got through, start from there */
+		drv->latency.guess_us = amc_adaptive_backoff_us(drv, drv->latency.guess_us);
+	}
+	if (ret >= 0) {
+		drv->latency.backoff = 0;
+	}
+	drv->wire_us = -1;
+	/* A response out of sequence is most likely one that was given up on,
+	arriving late. Doubling stops at drv->timeout_us long before 32 */
+	if ((ret == AMC_ETIMEOUT || ret == AMC_ESEQ) && drv->latency.backoff < 32) {
+		drv->latency.backoff++;
+	}
+	switch (ret) {
+	case AMC_ETIMEOUT:
+		drv->bus->stats.timeouts++;
+		break;
+	case AMC_ESEQ:
+		drv->bus->stats.seq_errors++;
+		break;
+	case AMC_ECRC:
+		drv->bus->stats.crc_errors++;
+		break;
+	}
+}
+
+/**
+\brief Read back a response from the drive
+\param *drv AMC drive to read
+\param *rsp Location to store the response header read back from drive
+\param *payload Location to store payload read back from drive (if any)
+\param payload_max_size Max. size in bytes of buffer pointed to by *payload
+\return Number of header and payload bytes read on success, negative error
+value on failure
+
+This function reads back a response from the drive. If the length of the
+response is known from the command just sent and no bytes are buffered,
+the response is read directly into *rsp and *payload with one readv per
+wakeup (see amc_resp_read_direct). Otherwise bytes are taken from
+the drive's receive ring and handed to an incremental decoder (see
+parser.c), which locks on to the start of the response header and uses it
+to determine how many words (if any) exist in the payload. When the ring
+runs dry, everything the port has available is read into it with a single
+call, so a response that has fully arrived costs one wakeup. Bytes that
+follow the response stay in the ring for the next call. Bytes in front of
+the response, such as the tail of an earlier response, are skipped.
+
+If any reads time out, an error is returned back to the caller.
+If the payload CRC does not match, or the header reports a sequence error
+or a failure status, an error is returned back to the caller. A payload
+larger than payload_max_size is rejected before any of it is stored, and
+skipped, so that the next response read starts on a frame boundary.
+
+Enabling the debug flag causes every byte received to be printed out in
+angle brackets, and errors to be printed out.
+*/
+int amc_resp_read(struct amc_drive *drv, struct amc_response *rsp, void *payload, int payload_max_size)
+{
+	int ret;
+
+	/* A response read without a command in front of it gets a deadline
+	of its own */
+	if (!drv->deadline_set) {
+		amc_deadline_start(drv, drv->timeout_us);
+		drv->wire_us = -1;
+	}
+
+	/* The length of the response is known from the command, and nothing
+	is buffered ahead of it: read it straight into place */
+	if (drv->rx_expect >= 0 && drv->bus->rx.head == drv->bus->rx.tail) {
+		ret = amc_resp_read_direct(drv, rsp, payload, payload_max_size);
+		if (ret != 0) {
+			drv->rx_expect = -1;
+			drv->deadline_set = 0;
+			amc_count_result(drv, ret);
+			return ret;
+		}
+	}
+	drv->rx_expect = -1;
+	ret = amc_resp_read_ring(drv, rsp, payload, payload_max_size);
+	drv->deadline_set = 0;
+	amc_count_result(drv, ret);
+	return ret;
+}
+
+
+/**
+\brief Bring the line back to a known state after a failed transaction
+\param *drv AMC drive whose port is recovered
+\return AMC_EOK once the line is quiet, AMC_ETIMEOUT if it was still busy
+after drv->retry.drain_max_us (the input is flushed either way)
+
+Late or partial responses are what turn one glitch into a run of sequence
+and CRC errors. This throws away everything buffered in the receive ring,
+reads and discards whatever the port delivers until nothing has arrived
+for drv->retry.quiet_us, then flushes the tty queues.
+*/
+int amc_recover(struct amc_drive *drv)
+{
+	struct amc_rxbuf *rx = &drv->bus->rx;
+	int ret;
+
+	assert(drv != NULL);
+
+	drv->bus->stats.recoveries++;
+	drv->bus->stats.drained += rx->tail - rx->head;
+	rx->head = rx->tail = 0;
+	drv->rx_expect = -1;
+
+	/* Drain under a deadline of its own, each wakeup waits for a quiet gap */
+	amc_deadline_start(drv, drv->retry.drain_max_us);
+	drv->wire_us = -1;
+
+	for (;;) {
+		struct timespec quiet;
+
+		quiet.tv_sec = drv->retry.quiet_us / 1000000;
+		quiet.tv_nsec = (drv->retry.quiet_us % 1000000) * 1000L;
+		do {
+			ret = drv->bus->xprt->ops->wait(drv->bus->xprt, &quiet);
+		} while ((ret == -1) && (errno == EINTR));
+		if (ret <= 0) {
+			ret = AMC_EOK;
+			break;
+		}
+		if (amc_wait_readable(drv) <= 0 || amc_rx_fill(drv) <= 0) {
+			ret = AMC_ETIMEOUT;
+			break;
+		}
+		drv->bus->stats.drained += rx->tail - rx->head;
+		rx->head = rx->tail = 0;
+	}
+	drv->deadline_set = 0;
+
+	drv->bus->xprt->ops->flush(drv->bus->xprt);
 	if (drv->debug) {
-		buffer = (uint8_t *)&readback_crc;
-		for (ctr = 0; ctr < sizeof(uint16_t); ctr++) {
-			printf("<%02X>", *(buffer + ctr));
+		printf("Recovered line, %lu stale bytes drained so far\n", drv->bus->stats.drained);
+	}
+	return ret;
+}
+
+/**
+\brief Tell whether a failed transaction is worth recovering from
+\param ret Error returned by amc_resp_read
+*/
+int amc_recoverable(int ret)
+{
+	return (ret == AMC_ESEQ) || (ret == AMC_ECRC) ||
+		(ret == AMC_ETIMEOUT) || (ret == AMC_EFRAMEERR);
+}
+
+/**
+\brief Check the CRCs of many independent blocks of data
+\param *spans Array of blocks to check
+\param count Number of entries in *spans
+\param *fail_map Failure bitmap, (count + 31) / 32 words long. Bit (i % 32)
+of word (i / 32) is set if spans[i] failed its CRC check, and cleared
+otherwise
+\return Number of blocks that failed the CRC check
+
+The blocks are checked four at a time with interleaved table lookups, which
+is considerably faster than checking short frames one after another. The
+expected CRCs are converted from network byte ordering the same way
+amc_resp_read does.
+*/
+int amc_crc_check_batch(const struct amc_crc_span *spans, int count, uint32_t *fail_map)
+{
+	int ctr, lane, failures = 0;
+
+	assert(spans != NULL || count == 0);
+	assert(fail_map != NULL);
+
+	for (ctr = 0; ctr < (count + 31) / 32; ctr++) {
+		fail_map[ctr] = 0;
+	}
+
+	for (ctr = 0; ctr < count; ctr += 4) {
+		uint16_t crc[4] = { 0, 0, 0, 0 };
+		const void *buf[4];
+		size_t len[4];
+		int lanes = (count - ctr < 4) ? count - ctr : 4;
+
+		for (lane = 0; lane < 4; lane++) {
+			/* Unused lanes repeat the first block so every pointer is valid */
+			const struct amc_crc_span *sp = &spans[ctr + ((lane < lanes) ? lane : 0)];
+			buf[lane] = sp->data;
+			len[lane] = (lane < lanes) ? sp->len : 0;
 		}
-		printf("\n");
+		amc_crc_update_x4(crc, buf, len);
+
+		for (lane = 0; lane < lanes; lane++) {
+			int idx = ctr + lane;
+			if (crc[lane] != ntohs(spans[idx].crc)) {
+				fail_map[idx / 32] |= 1UL << (idx % 32);
+				failures++;
+			}
+		}
+	}
+	return failures;
+}
+
+/**
+\brief Describe the CRC-protected blocks of a raw frame
+\param *frame Raw bytes of a command or response frame, starting with the SOF
+\param frame_len Number of bytes in the frame
+\param *spans Array of at least two entries, filled in with the header span
+and, if the frame has a payload, the payload span
+\return Number of spans filled in (1 or 2), or AMC_EFRAMEERR if the frame
+length does not match its header
+
+Command and response headers have the same layout, so this works on frames
+captured in either direction. The result can be passed straight to
+amc_crc_check_batch.
+*/
+int amc_frame_crc_spans(const void *frame, int frame_len, struct amc_crc_span *spans)
+{
+	const uint8_t *buffer = (const uint8_t *)frame;
+	const struct amc_response *hdr = (const struct amc_response *)frame;
+	int payload_bytes;
+
+	assert(frame != NULL);
+	assert(spans != NULL);
+
+	if (frame_len < 0 || frame_len < (int)sizeof(struct amc_response)) {
+		return AMC_EFRAMEERR;
 	}
+	spans[0].data = buffer;
+	spans[0].len = sizeof(struct amc_response) - sizeof(uint16_t);
+	spans[0].crc = hdr->crc;
 
-	buffer = (uint8_t *)payload;
-	bytes_to_check = rsp->payload_len * sizeof(uint16_t);
-	crc = 0;
+	if (frame_len == (int)sizeof(struct amc_response)) {
+		return 1;
+	}
 
-	for (ctr = 0; ctr < bytes_to_check; ctr++) {
-		amc_crc_check_word(*(buffer + ctr), &crc, drv->crc_table);
+	payload_bytes = hdr->payload_len * sizeof(uint16_t);
+	if (frame_len != (int)(sizeof(struct amc_response) + payload_bytes + sizeof(uint16_t))) {
+		return AMC_EFRAMEERR;
 	}
-	
-	/* Convert received CRC back to host byte ordering */
-	if (crc != ntohs(readback_crc)) {
+	spans[1].data = buffer + sizeof(struct amc_response);
+	spans[1].len = payload_bytes;
+	/* The payload CRC may be unaligned, assemble it in wire order */
+	spans[1].crc = htons((buffer[frame_len - 2] << 8) | buffer[frame_len - 1]);
+	return 2;
+}
+
+/**
+\brief Run one complete transaction with a drive
+\param *drv AMC drive to talk to
+\param access_type One of AMC_CMDTYPE_* macros
+\param index Index of the parameter
+\param offset Offset of the parameter
+\param *payload Payload to send, can be NULL if payload_len is zero
+\param payload_len Length of payload in bytes
+\param *buffer Location to store the payload read back, can be NULL if
+bufsize is zero
+\param bufsize Size of the buffer pointed to by *buffer, also the length
+asked for by reads
+\return Number of header and payload bytes read back on success, negative
+error value on failure
+
+Sends the command and reads back the response. Sequence, CRC, frame errors
+and timeouts are recovered from with amc_recover; reads (which are
+idempotent) are then retried as set by drv->retry, writes are not.
+*/
+int amc_transact(struct amc_drive *drv, int access_type, int index, int offset,
+	const void *payload, int payload_len, void *buffer, int bufsize)
+{
+	struct amc_command cmd;
+	struct amc_response resp;
+	int attempt, ret;
+
+	assert(drv != NULL);
+
+	for (attempt = 0; ; attempt++) {
+		cmd.index = index;
+		cmd.offset = offset;
+
+		ret = amc_cmd_write(drv, &cmd, access_type, bufsize, (uint16_t *)payload, payload_len);
+		if (ret < 0) {
+			if (drv->debug) {
+				printf("Could not write command\n");
+			}
+			return ret;
+		}
+
+		ret = amc_resp_read(drv, &resp, buffer, bufsize);
+		if (ret >= 0) {
+			return ret;
+		}
+		if (!amc_recoverable(ret)) {
+			break;
+		}
+		/* The line is cleaned up even when the command is not retried, so
+		the next transaction starts in sync */
+		amc_recover(drv);
+		if (access_type != AMC_CMDTYPE_READ || attempt >= drv->retry.max_retries) {
+			break;
+		}
+		drv->bus->stats.retries++;
 		if (drv->debug) {
-			printf("CRC failed (expected %04X, got %04X)\n", crc, ntohs(readback_crc));
+			printf("Retrying read of %02X:%02X (%d)\n", index, offset, ret);
 		}
-		return AMC_ECRC;
 	}
 
-	return total_bytes_read;
+	if (access_type == AMC_CMDTYPE_READ) {
+		drv->bus->stats.failures++;
+	}
+	if (drv->debug) {
+		printf("Could not read back %s\n", (access_type == AMC_CMDTYPE_READ) ? "data" : "response");
+	}
+	return ret;
 }
 
 /**
@@ -397,31 +1726,14 @@ int amc_resp_read(struct amc_drive *drv, struct amc_response *rsp, void *payload
 \param *buffer Location to store the parameter read back
 \param bufsize Size of the buffer pointed to by *buffer
 \return 0 on success, -1 on failure
+
+Sequence, CRC, frame errors and timeouts are recovered from with
+amc_recover and the read is retried as set by drv->retry.
 */
 int amc_get_string(struct amc_drive *drv, int index, int offset, void *buffer, int bufsize)
 {
-	assert (drv != NULL);
 	assert (buffer != NULL);
-	struct amc_command cmd;
-	struct amc_response resp;
-
-	cmd.index = index;
-	cmd.offset = offset;
-
-	if (0 > amc_cmd_write(drv, &cmd, AMC_CMDTYPE_READ, bufsize, NULL, 0)) {
-		if (drv->debug) {
-			printf("Could not write command\n");
-		}
-		return -1;
-	}
-	
-	if (0 > amc_resp_read(drv, &resp, buffer, bufsize)) {
-		if (drv->debug) {
-			printf("Could not read back data\n");
-		}
-		return -1;
-	}
-	return 0;
+	return (amc_transact(drv, AMC_CMDTYPE_READ, index, offset, NULL, 0, buffer, bufsize) < 0) ? -1 : 0;
 }
 
 /**
@@ -461,27 +1773,8 @@ int amc_get_uint32(struct amc_drive *drv, int index, int offset, uint32_t *buffe
 */
 int amc_write_string(struct amc_drive *drv, int index, int offset, void *buffer, int bufsize)
 {
-	assert (drv != NULL);
 	assert (buffer != NULL);
-	struct amc_command cmd;
-	struct amc_response resp;
-
-	cmd.index = index;
-	cmd.offset = offset;
-
-	if (0 > amc_cmd_write(drv, &cmd, AMC_CMDTYPE_WRITE, 0, buffer, bufsize)) {
-		if (drv->debug) {
-			printf("Could not write command\n");
-		}
-		return -1;
-	}
-	if (0 > amc_resp_read(drv, &resp, NULL, 0)) {
-		if (drv->debug) {
-			printf("Could not read response\n");
-		}
-		return -1;
-	}
-	return 0;
+	return (amc_transact(drv, AMC_CMDTYPE_WRITE, index, offset, buffer, bufsize, NULL, 0) < 0) ? -1 : 0;
 }
 
 /**
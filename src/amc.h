@@ -11,11 +11,35 @@ the AMC servo drive communications library
 #define _AMC_H_
 
 #include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 #define AMC_SOF_BYTE 0xA5
+/* Defined again in crc.h, which mkcrctable uses; the two must agree */
 #define AMC_CRC_POLY 0x1021
 
 #define AMC_DEFAULT_TIMEOUT_MS 1000
+#define AMC_DEFAULT_TIMEOUT_US (AMC_DEFAULT_TIMEOUT_MS * 1000)
+
+/* On-wire size of a byte for 8N1 framing: start bit, 8 data bits, stop bit */
+#define AMC_BITS_PER_BYTE 10
+
+/* Adaptive timeouts, see amc_transaction_timeout_us */
+#define AMC_LATENCY_BUCKETS 88
+#define AMC_LATENCY_WINDOW 4096
+#define AMC_ADAPTIVE_MIN_SAMPLES 32
+#define AMC_ADAPTIVE_PERMILLE 999
+#define AMC_ADAPTIVE_MARGIN_US 1000
+#define AMC_ADAPTIVE_INITIAL_US 50000
+
+/* Default recovery policy, see struct amc_retry_policy */
+#define AMC_DEFAULT_MAX_RETRIES 2
+#define AMC_DEFAULT_QUIET_US 5000
+#define AMC_DEFAULT_DRAIN_MAX_US 100000
+
+/* Largest payload a frame can carry, payload_len is a word count */
+#define AMC_MAX_PAYLOAD (255 * 2)
 
 #define AMC_EOK 0
 #define AMC_ESERIALINIT -1
@@ -31,6 +55,8 @@ the AMC servo drive communications library
 #define AMC_EFRAMEERR -11
 #define AMC_EUNKNOWNSTATUS -12
 #define AMC_EBUFSIZE -13
+#define AMC_EPORT -14
+#define AMC_ECANCELED -15
 
 #define AMC_CMDTYPE_READ 1
 #define AMC_CMDTYPE_WRITE 2
@@ -102,13 +128,174 @@ the AMC servo drive communications library
 #define AMC_DS_NEGVELOCITYLIM (1 << 4)
 #define AMC_DS_CMDPROFILER (1 << 5)
 
+/* Port tuning for amc_serial_open_flags, also reported back as applied */
+#define AMC_SERIAL_ASYNC_LOW_LATENCY (1 << 0) /* ASYNC_LOW_LATENCY via TIOCSSERIAL */
+#define AMC_SERIAL_USB_LATENCY_TIMER (1 << 1) /* USB-serial latency timer via sysfs */
+#define AMC_SERIAL_POLLED_READ (1 << 2) /* VMIN=0, VTIME=0, reads never block */
+#define AMC_SERIAL_LOW_LATENCY (AMC_SERIAL_ASYNC_LOW_LATENCY | \
+	AMC_SERIAL_USB_LATENCY_TIMER | AMC_SERIAL_POLLED_READ)
+
+/* Latency timer set on USB-serial adapters, in milliseconds */
+#define AMC_SERIAL_USB_LATENCY_MS 1
+
+/**
+\brief RS-485 half-duplex settings of a serial port
+
+The kernel drives RTS as the transmitter enable: it is switched to the
+rts_on_send level before a frame goes out and back once the last stop bit
+has left the UART, with the delays below added around the frame. See
+amc_serial_set_rs485.
+*/
+struct amc_rs485 {
+	int enabled; /**< Nonzero to let the driver switch RTS around each send */
+	int rts_on_send; /**< RTS level while sending, 1 = high; the opposite level applies after */
+	int delay_before_send_ms; /**< Delay between raising the enable and the first bit, in milliseconds */
+	int delay_after_send_ms; /**< Delay between the last bit and dropping the enable, in milliseconds */
+	int rx_during_tx; /**< Nonzero to keep the receiver on while sending (echo is then read back) */
+};
+
+/* Size of the receive ring, must be a power of two and hold at least one
+maximum size response */
+#define AMC_RXBUF_SIZE 1024
+
+/**
+\brief Receive ring for a serial port
+
+Holds bytes read from the port that have not been decoded yet. head and
+tail are free running byte counters, their difference is the fill level.
+*/
+struct amc_rxbuf {
+	unsigned int head; /**< Count of bytes taken out of the ring */
+	unsigned int tail; /**< Count of bytes put into the ring */
+	uint8_t data[AMC_RXBUF_SIZE]; /**< Ring storage */
+};
+
+struct amc_transport;
+
+/**
+\brief Operations of a transport
+
+The protocol code only talks to the port through these. writev and readv
+behave like the system calls of the same name, returning -1 and setting
+errno on failure. wait returns 1 once data can be read, 0 when the timeout
+expires first, and -1 with errno set on error (EINTR is passed up, the
+caller retries with the time that is left). flush throws away anything
+queued in either direction. close releases the port and may be NULL.
+*/
+struct amc_transport_ops {
+	ssize_t (*writev)(struct amc_transport *xprt, const struct iovec *iov, int iovcnt);
+	ssize_t (*readv)(struct amc_transport *xprt, const struct iovec *iov, int iovcnt);
+	int (*wait)(struct amc_transport *xprt, const struct timespec *timeout);
+	void (*flush)(struct amc_transport *xprt);
+	void (*close)(struct amc_transport *xprt);
+};
+
+/**
+\brief A port that AMC frames are sent and received over
+
+fd is the underlying file descriptor if there is one, it is used to read
+back the baud rate and to tell whether two transports share a port.
+Transports that are not backed by a descriptor set it to -1.
+
+While a command is written, deadline points to the deadline of its
+transaction. Transports whose writev can block for long (behind an
+earlier write that is stuck, for example) give up at that point and fail
+with errno set to ETIMEDOUT.
+*/
+struct amc_transport {
+	const struct amc_transport_ops *ops; /**< Transport operations */
+	int fd; /**< Underlying file descriptor, -1 if none */
+	void *priv; /**< Private data of the transport */
+	const struct timespec *deadline; /**< CLOCK_MONOTONIC deadline for writev, NULL for none */
+};
+
+/**
+\brief How a drive recovers from a garbled transaction
+
+After a sequence error, CRC error, timeout or frame error, whatever is left
+of the failed response is drained from the port until the line has been
+quiet for quiet_us, and the tty input queue is flushed. Reads (which are
+idempotent) are then retried up to max_retries times.
+*/
+struct amc_retry_policy {
+	int max_retries; /**< Retries of a failed read, 0 to disable */
+	int quiet_us; /**< Silence on the line that ends draining, in microseconds */
+	int drain_max_us; /**< Upper bound on the time spent draining, in microseconds */
+};
+
+/**
+\brief Running distribution of a drive's turnaround latency
+
+Histogram with four buckets per octave of microseconds. Counts are halved
+once AMC_LATENCY_WINDOW samples have been collected, so the distribution
+follows changes in the drive's behaviour.
+*/
+struct amc_latency {
+	unsigned int count; /**< Samples in the histogram */
+	unsigned int bucket[AMC_LATENCY_BUCKETS]; /**< Sample counts */
+	unsigned int guess_us; /**< Turnaround assumed until there are enough samples */
+	unsigned int backoff; /**< Timeouts since the last response, each doubling the turnaround allowed */
+};
+
+/**
+\brief Transaction statistics of a drive
+*/
+struct amc_stats {
+	unsigned long transactions; /**< Responses read, successful or not */
+	unsigned long timeouts; /**< Responses that did not arrive in time */
+	unsigned long seq_errors; /**< Responses with the wrong sequence number */
+	unsigned long crc_errors; /**< Responses with a bad payload CRC */
+	unsigned long recoveries; /**< Times the line was drained and flushed */
+	unsigned long drained; /**< Stale bytes thrown away while recovering */
+	unsigned long retries; /**< Reads retried after a recoverable error */
+	unsigned long failures; /**< Reads that failed after all retries */
+};
+
+/* Range of addresses drives can be attached to a bus at */
+#define AMC_ADDR_MIN 0x01
+#define AMC_ADDR_MAX 0x3F
+
+/**
+\brief A serial line and everything the drives on it share
+
+One transaction is on the line at a time, whichever drive it is with, so
+the sequence counter, the bytes read ahead and the statistics belong to
+the line rather than to any one drive. Set up with amc_bus_new or
+amc_bus_new_transport, then attach a struct amc_drive for each address
+with amc_drive_attach.
+*/
+struct amc_bus {
+	struct amc_transport *xprt; /**< Transport of the line */
+	struct amc_transport tty; /**< Transport used by amc_bus_new */
+	uint8_t seq_ctr; /**< Message sequence counter, shared by all drives */
+	int baud; /**< Baud rate of the line, 0 if unknown */
+	struct amc_stats stats; /**< Transaction statistics of all drives on the line */
+	struct amc_rxbuf rx; /**< Bytes read ahead from the line */
+};
+
+/**
+\brief Handle of one drive on a bus
+
+Holds what is particular to the drive: its address, timeouts, retry
+policy and turnaround latency, and the state of its current transaction.
+A drive set up by amc_drive_new or amc_drive_new_transport points bus
+into itself, so it must not be copied or moved once initialized.
+*/
 struct amc_drive {
-	uint8_t seq_ctr; /**< Message sequence counter */
-	uint16_t *crc_table; /**< Cached CRC table */
-	int device; /**< Device number for the communications port */
+	uint8_t seq_ctr; /**< Sequence number of the last command sent to the drive */
+	struct amc_bus *bus; /**< Bus the drive is on, own_bus unless attached */
+	struct amc_bus own_bus; /**< Private bus of a drive set up by amc_drive_new */
 	int address; /**< Device address */
-	int timeout_ms; /**< Read timeout in milliseconds */
+	int timeout_us; /**< Time allowed for a whole transaction, in microseconds (was timeout_ms before 0.2.0) */
+	struct timespec deadline; /**< CLOCK_MONOTONIC deadline of the current transaction */
+	int deadline_set; /**< Nonzero while deadline is in use */
+	struct amc_retry_policy retry; /**< Recovery and retry policy */
+	int adaptive_timeout; /**< Nonzero to derive timeouts from wire time and latency */
+	struct amc_latency latency; /**< Turnaround latency of the drive */
+	struct timespec sent; /**< When the current command was sent */
+	int wire_us; /**< Wire time of the current transaction, -1 if unknown */
 	int debug; /**< Debug flag, set to 1 to enable debug messages */
+	int rx_expect; /**< Payload bytes expected in the next response, -1 if unknown */
 };
 
 union amc_control {
@@ -171,12 +358,311 @@ struct amc_product_info {
 	uint8_t product_build_time[32];
 } __attribute__((__packed__));
 
+/**
+\brief Pre-encoded command for a fixed transaction
+
+Holds the command header for every sequence number with its CRC already
+computed. Set up with amc_frame_template_init, send with
+amc_cmd_write_template.
+*/
+struct amc_frame_template {
+	struct amc_command hdr[16]; /**< Header for each sequence number */
+	int payload_len; /**< Bytes of payload sent with the command */
+};
+
+/**
+\brief Incremental response decoder
+
+Feed it received bytes with amc_parser_push, it returns complete frames
+with their CRCs checked. See parser.c.
+*/
+struct amc_parser {
+	int state; /**< Decoding state, internal */
+	int count; /**< Bytes collected in the current state, internal */
+	int payload_size; /**< Payload bytes of the current frame */
+	void *payload; /**< Where the payload is stored */
+	int payload_max; /**< Size of the buffer pointed to by payload */
+	struct amc_response rsp; /**< Header of the current frame */
+	uint16_t payload_crc; /**< Payload CRC as received */
+	unsigned long frames; /**< Frames decoded successfully */
+	unsigned long resyncs; /**< Headers rejected by their CRC */
+	unsigned long crc_errors; /**< Payloads rejected by their CRC */
+	unsigned long dropped; /**< Frames skipped because the payload did not fit */
+	unsigned long discarded; /**< Bytes thrown away while looking for a frame */
+	uint8_t buffer[AMC_MAX_PAYLOAD]; /**< Default payload buffer */
+};
+
+/* Size of the fault injector's queue of bytes waiting to be read */
+#define AMC_FAULT_QUEUE_SIZE 4096
+
+/**
+\brief What a fault-injecting transport does to received bytes
+
+Probabilities are in parts per million. Byte faults are drawn for every
+byte read from the underlying transport, the others once per read.
+The same seed and settings produce the same faults for the same traffic.
+*/
+struct amc_fault_config {
+	unsigned int seed; /**< Seed of the pseudo-random generator */
+	int flip_ppm; /**< Per byte: flip one bit */
+	int drop_ppm; /**< Per byte: lose the byte */
+	int dup_ppm; /**< Per byte: deliver the byte twice */
+	int truncate_ppm; /**< Per read: lose everything after a random point */
+	int delay_ppm; /**< Per read: hold the bytes back for delay_us */
+	int delay_us; /**< How long delayed bytes are held, in microseconds */
+	int stale_ppm; /**< Per response: precede it with a repeat of the previous one */
+};
+
+/**
+\brief Faults injected so far, see struct amc_fault_config
+*/
+struct amc_fault_stats {
+	unsigned long bytes; /**< Bytes read from the underlying transport */
+	unsigned long flips; /**< Bits flipped */
+	unsigned long drops; /**< Bytes lost */
+	unsigned long dups; /**< Bytes delivered twice */
+	unsigned long truncations; /**< Reads cut short */
+	unsigned long delays; /**< Reads held back */
+	unsigned long stale; /**< Stale responses inserted */
+};
+
+/**
+\brief Transport that injects faults into another one
+
+Initialize with amc_fault_init and create drives on its xprt member. See
+fault.c.
+*/
+struct amc_fault {
+	struct amc_transport xprt; /**< The fault-injecting transport */
+	struct amc_transport *lower; /**< Transport the bytes really go through */
+	struct amc_fault_config cfg; /**< Fault settings */
+	struct amc_fault_stats stats; /**< Faults injected */
+	uint64_t rng; /**< Generator state, internal */
+	struct timespec hold_until; /**< Queued bytes are not released before this, internal */
+	int queue_len; /**< Bytes in queue, internal */
+	int frame_start; /**< Next byte read starts a response, internal */
+	int hdr_len; /**< Bytes of the current response header seen, internal */
+	int have_last; /**< Nonzero once last_hdr is valid, internal */
+	struct amc_response hdr; /**< Header of the current response, internal */
+	struct amc_response last_hdr; /**< Header of the previous response, internal */
+	uint8_t queue[AMC_FAULT_QUEUE_SIZE]; /**< Bytes waiting to be read, internal */
+};
+
+/**
+\brief Shared io_uring for many serial ports, opaque, see uring.c
+*/
+struct amc_uring;
+
+/**
+\brief System call and request counts of a struct amc_uring
+*/
+struct amc_uring_stats {
+	unsigned long enters; /**< io_uring_enter calls */
+	unsigned long submitted; /**< Requests handed to the kernel */
+	unsigned long completed; /**< Completions taken off the ring */
+};
+
+/**
+\brief Event loop driving transactions on many ports, opaque, see loop.c
+*/
+struct amc_loop;
+
+struct amc_loop_txn;
+
+/**
+\brief Called by the event loop when a transaction has finished
+*/
+typedef void (*amc_loop_done_fn)(struct amc_loop_txn *txn);
+
+/**
+\brief One transaction queued on an event loop with amc_loop_submit
+
+The transport of the drive's bus must have been added to the loop. Set drv, index,
+offset, access_type, the payload to send and the buffer for the payload
+read back, and done. Reads are retried after recoverable errors as set
+by drv->retry, as amc_get_string does. The structure must stay in place
+until done is called.
+*/
+struct amc_loop_txn {
+	struct amc_drive *drv; /**< Drive the transaction is with */
+	int index; /**< Index of the parameter */
+	int offset; /**< Offset of the parameter */
+	int access_type; /**< One of AMC_CMDTYPE_* */
+	const void *payload; /**< Payload to send, can be NULL if payload_len is zero */
+	int payload_len; /**< Length of payload in bytes, 0 for reads */
+	void *buffer; /**< Where the payload read back is stored, can be NULL for writes */
+	int buffer_len; /**< Size of buffer, also the length asked for by reads */
+	amc_loop_done_fn done; /**< Completion callback, can be NULL */
+	void *user; /**< For the caller, not used by the loop */
+	int result; /**< Header and payload bytes read back, or negative error value */
+	int attempt; /**< Attempts made so far, internal */
+	struct amc_loop_txn *next; /**< Next transaction queued on the port, internal */
+};
+
+/**
+\brief Bus worker thread, opaque, see worker.c
+*/
+struct amc_worker;
+
+/* Priority classes of bus worker requests, most urgent first */
+#define AMC_PRIO_CONTROL 0 /**< Command writes, e.g. setpoints to 0x45:00 */
+#define AMC_PRIO_STATUS 1 /**< Monitoring, e.g. fault status reads of 0x02:xx */
+#define AMC_PRIO_BACKGROUND 2 /**< Bulk reads, e.g. amc_get_product_info */
+#define AMC_PRIO_CLASSES 3
+
+/**
+\brief Requests completed and deadlines missed per priority class
+*/
+struct amc_worker_stats {
+	unsigned long completed[AMC_PRIO_CLASSES]; /**< Requests completed, including cancelled ones */
+	unsigned long missed[AMC_PRIO_CLASSES]; /**< Requests completed after their deadline */
+};
+
+struct amc_request;
+
+/**
+\brief Called by a bus worker thread when a request has finished
+*/
+typedef void (*amc_request_done_fn)(struct amc_request *req);
+
+/**
+\brief One transaction handed to a bus worker with amc_worker_submit
+
+Set drv, index, offset, access_type, the payload to send and the buffer
+for the payload read back. Either set done to be called from the worker
+thread, or leave it NULL and collect the result with amc_request_wait.
+The structure must stay in place until then.
+
+priority picks one of AMC_PRIO_*, deadline_us optionally sets a deadline
+relative to amc_worker_submit. A long read with word_addressed set may be
+split so that more urgent requests can run in between. See worker.c for
+how they are scheduled.
+*/
+struct amc_request {
+	struct amc_drive *drv; /**< Drive the transaction is with */
+	int index; /**< Index of the parameter */
+	int offset; /**< Offset of the parameter */
+	int access_type; /**< One of AMC_CMDTYPE_* */
+	const void *payload; /**< Payload to send, can be NULL if payload_len is zero */
+	int payload_len; /**< Length of payload in bytes, 0 for reads */
+	void *buffer; /**< Where the payload read back is stored, can be NULL for writes */
+	int buffer_len; /**< Size of buffer, also the length asked for by reads */
+	int priority; /**< One of AMC_PRIO_* */
+	long deadline_us; /**< Time allowed from submission to completion, 0 for none */
+	int word_addressed; /**< Nonzero if offsets of index count 16-bit words, so a read may be split */
+	amc_request_done_fn done; /**< Completion callback, can be NULL */
+	void *user; /**< For the caller, not used by the worker */
+	int result; /**< As returned by amc_transact, valid once complete */
+	int state; /**< Nonzero once complete, internal */
+	long long due_ns; /**< Absolute deadline on CLOCK_MONOTONIC, internal */
+	int progress; /**< Bytes of a sliced read done so far, internal */
+	struct amc_request *next; /**< Queue link, internal */
+};
+
+/* Maximum number of iovecs handed to a single writev by amc_cmd_write_batch */
+#define AMC_BATCH_IOV_MAX 1023
+
+/**
+\brief One command of a batch sent with amc_cmd_write_batch
+*/
+struct amc_cmd_batch {
+	struct amc_drive *drv; /**< Drive to send the command to */
+	struct amc_command cmd; /**< Command header, index and offset set by the caller */
+	int access_type; /**< One of AMC_CMDTYPE_* */
+	int response_len; /**< Expected response length, in bytes */
+	const void *payload; /**< Payload to send, can be NULL if payload_len is zero */
+	int payload_len; /**< Length of payload in bytes */
+	int result; /**< Bytes written or negative error value, set by amc_cmd_write_batch */
+	uint16_t payload_crc; /**< Payload CRC, used internally */
+};
+
+/**
+\brief A block of bytes and the CRC that was sent with it
+
+Used to check many CRCs at once with amc_crc_check_batch, for example
+the header and payload of captured frames. The CRC is kept exactly as
+it appears on the wire (big-endian), as in struct amc_response.
+*/
+struct amc_crc_span {
+	const void *data; /**< First byte covered by the CRC */
+	int len; /**< Number of bytes covered by the CRC */
+	uint16_t crc; /**< Expected CRC, in network byte ordering */
+};
+
 int amc_serial_open(char *dev, int spd);
+int amc_serial_open_flags(char *dev, int spd, int flags, int *applied);
 int amc_drive_new(struct amc_drive *drv, int address, int serial_fd);
+int amc_drive_new_transport(struct amc_drive *drv, int address, struct amc_transport *xprt);
+int amc_drive_attach(struct amc_drive *drv, struct amc_bus *bus, int address);
+void amc_drive_destroy(struct amc_drive *drv);
+int amc_bus_new(struct amc_bus *bus, int serial_fd);
+int amc_bus_new_transport(struct amc_bus *bus, struct amc_transport *xprt);
+void amc_bus_destroy(struct amc_bus *bus);
+void amc_transport_tty(struct amc_transport *xprt, int fd);
+void amc_transport_close(struct amc_transport *xprt);
+int amc_tcp_open(struct amc_transport *xprt, const char *host, const char *port, int timeout_ms);
+int amc_cmd_encode(struct amc_drive *drv, struct amc_command *cmd, int access_type,
+	int response_len, const void *payload, int payload_len, uint16_t *payload_crc);
+int amc_resp_check_header(struct amc_drive *drv, const struct amc_response *rsp);
+int amc_resp_check_payload(struct amc_drive *drv, const struct amc_response *rsp,
+	const void *payload, uint16_t payload_crc);
 int amc_cmd_write(struct amc_drive *drv, struct amc_command *cmd, int access_type, 
 	int response_len, uint16_t *payload, int payload_len);
 int amc_resp_read(struct amc_drive *drv, struct amc_response *rsp, void *payload, int payload_max_size);
+int amc_cmd_write_batch(struct amc_cmd_batch *batch, int count);
+int amc_recover(struct amc_drive *drv);
+
+int amc_serial_get_baud(int fd);
+int amc_serial_set_baud(int fd, int spd);
+int amc_serial_set_rs485(int fd, struct amc_rs485 *cfg);
+int amc_serial_get_rs485(int fd, struct amc_rs485 *cfg);
+int amc_wire_time_us(const struct amc_drive *drv, int bytes);
+int amc_latency_percentile_us(const struct amc_drive *drv, int permille);
+int amc_transaction_timeout_us(const struct amc_drive *drv, int cmd_bytes, int resp_bytes);
+
+int amc_frame_template_init(struct amc_frame_template *tpl, struct amc_drive *drv,
+	int index, int offset, int access_type, int len);
+int amc_cmd_encode_template(struct amc_drive *drv, const struct amc_frame_template *tpl,
+	const void *payload, const struct amc_command **cmd, uint16_t *payload_crc);
+int amc_cmd_write_template(struct amc_drive *drv, const struct amc_frame_template *tpl,
+	const void *payload);
+
+void amc_parser_init(struct amc_parser *p);
+void amc_parser_reset(struct amc_parser *p);
+void amc_parser_set_payload(struct amc_parser *p, void *payload, int payload_max);
+int amc_parser_wanted(const struct amc_parser *p);
+int amc_parser_push(struct amc_parser *p, const void *data, int len, int *consumed);
+
+void amc_fault_init(struct amc_fault *f, struct amc_transport *lower,
+	const struct amc_fault_config *cfg);
+
+struct amc_loop *amc_loop_new(void);
+void amc_loop_free(struct amc_loop *loop);
+int amc_loop_add_port(struct amc_loop *loop, struct amc_transport *xprt);
+int amc_loop_remove_port(struct amc_loop *loop, struct amc_transport *xprt);
+int amc_loop_submit(struct amc_loop *loop, struct amc_loop_txn *txn);
+int amc_loop_fd(const struct amc_loop *loop);
+int amc_loop_dispatch(struct amc_loop *loop, int timeout_ms);
+int amc_loop_pending(const struct amc_loop *loop);
+
+struct amc_worker *amc_worker_new(struct amc_bus *bus);
+void amc_worker_free(struct amc_worker *w);
+int amc_worker_submit(struct amc_worker *w, struct amc_request *req);
+int amc_request_wait(struct amc_request *req);
+int amc_request_done(const struct amc_request *req);
+void amc_worker_get_stats(struct amc_worker *w, struct amc_worker_stats *stats);
+
+struct amc_uring *amc_uring_new(int max_ports);
+void amc_uring_free(struct amc_uring *u);
+int amc_uring_transport(struct amc_uring *u, struct amc_transport *xprt, int fd);
+int amc_uring_submit(struct amc_uring *u);
+void amc_uring_get_stats(const struct amc_uring *u, struct amc_uring_stats *stats);
+
+int amc_crc_check_batch(const struct amc_crc_span *spans, int count, uint32_t *fail_map);
+int amc_frame_crc_spans(const void *frame, int frame_len, struct amc_crc_span *spans);
 
+int amc_transact(struct amc_drive *drv, int access_type, int index, int offset,
+	const void *payload, int payload_len, void *buffer, int bufsize);
 int amc_get_string(struct amc_drive *drv, int index, int offset, void *buffer, int bufsize);
 int amc_get_uint16(struct amc_drive *drv, int index, int offset, uint16_t *buffer);
 int amc_get_uint32(struct amc_drive *drv, int index, int offset, uint32_t *buffer);
@@ -10,7 +10,10 @@ CRC polynomial used in the AMC servo drives.
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stddef.h>
+#include "amc.h"
 #include "crc.h"
+#include "crctable.h"
 
 typedef float(*crcfnptr)(unsigned short, unsigned short, unsigned short);
 
@@ -46,7 +49,9 @@ static unsigned short crchware(uint16_t data, uint16_t genpoly, uint16_t accum)
 This function computes a lookup table that's used by amc_crc_check_word to
 compute CRCs. The lookup table is 256 16-bit words long, and is allocated by
 this function. A NULL is returned on memory allocation failure. The block
-must be freed later on using free().
+must be freed later on using free(). The library itself no longer calls
+this, the table for AMC_CRC_POLY is available as static data through
+amc_crc_table().
 */
 unsigned short *amc_crc_mktable(uint16_t poly)
 {
@@ -66,10 +71,277 @@ unsigned short *amc_crc_mktable(uint16_t poly)
 \brief Check CRC of a single 16-bit word
 \param data Input data to verify CRC
 \param *accumulator Pointer to temporary storage where previous data was checked
-\param *crc_table Pointer to lookup table used to speed up CRC computations
+\param *table Pointer to lookup table used to speed up CRC computations
 */
-void amc_crc_check_word(uint16_t data, uint16_t *accumulator, uint16_t *crc_table)
+void amc_crc_check_word(uint16_t data, uint16_t *accumulator, const uint16_t *table)
 {
-	*accumulator = (*accumulator << 8) ^ crc_table[(*accumulator >> 8) ^ data];
+	*accumulator = (*accumulator << 8) ^ table[(*accumulator >> 8) ^ data];
 }
 
+
+/**
+\brief Update a CRC with a block of data using table lookups
+\param crc CRC accumulated over previous data, 0 to start a new CRC
+\param *buf Data to add to the CRC
+\param len Number of bytes in *buf
+\return Updated CRC, in host byte ordering
+
+Computes the same CRC as calling amc_crc_check_word once per byte, but
+processes eight bytes per step using slicing-by-8 table lookups. The
+running CRC is folded into the first two bytes of each step, so the
+tables only depend on the polynomial and not on the data alignment.
+The tables are const data generated at build time (see crctable.h).
+*/
+uint16_t amc_crc_update_slice8(uint16_t crc, const void *buf, size_t len)
+{
+	const uint8_t *p = (const uint8_t *)buf;
+
+	while (len >= 8) {
+		crc = crc_table[7][p[0] ^ (crc >> 8)] ^
+			crc_table[6][p[1] ^ (crc & 0xFF)] ^
+			crc_table[5][p[2]] ^
+			crc_table[4][p[3]] ^
+			crc_table[3][p[4]] ^
+			crc_table[2][p[5]] ^
+			crc_table[1][p[6]] ^
+			crc_table[0][p[7]];
+		p += 8;
+		len -= 8;
+	}
+	if (len >= 4) {
+		crc = crc_table[3][p[0] ^ (crc >> 8)] ^
+			crc_table[2][p[1] ^ (crc & 0xFF)] ^
+			crc_table[1][p[2]] ^
+			crc_table[0][p[3]];
+		p += 4;
+		len -= 4;
+	}
+	while (len--) {
+		crc = (crc << 8) ^ crc_table[0][(crc >> 8) ^ *p++];
+	}
+	return crc;
+}
+
+/**
+\brief Update four independent CRCs with interleaved table lookups
+\param *crc Array of four CRCs, updated in place
+\param **buf Array of four data pointers
+\param *len Array of four data lengths, in bytes
+
+The lanes are stepped together, so the table lookups of one lane overlap
+with those of the others instead of waiting on the previous step of the
+same CRC. This is what makes short frames cheap to check in bulk, where a
+single CRC is bound by the latency of its dependency chain. Bytes past
+the shortest lane are finished one lane at a time.
+*/
+void amc_crc_update_x4(uint16_t *crc, const void *const *buf, const size_t *len)
+{
+	const uint8_t *p0 = buf[0], *p1 = buf[1], *p2 = buf[2], *p3 = buf[3];
+	uint16_t c0 = crc[0], c1 = crc[1], c2 = crc[2], c3 = crc[3];
+	size_t common = len[0];
+	size_t done;
+	int lane;
+
+	for (lane = 1; lane < 4; lane++) {
+		if (len[lane] < common) common = len[lane];
+	}
+
+#define CRC_STEP4(c, p) \
+	c = crc_table[3][p[0] ^ (c >> 8)] ^ crc_table[2][p[1] ^ (c & 0xFF)] ^ \
+		crc_table[1][p[2]] ^ crc_table[0][p[3]]; \
+	p += 4;
+
+	for (done = 0; done + 4 <= common; done += 4) {
+		CRC_STEP4(c0, p0)
+		CRC_STEP4(c1, p1)
+		CRC_STEP4(c2, p2)
+		CRC_STEP4(c3, p3)
+	}
+#undef CRC_STEP4
+
+	crc[0] = amc_crc_update_slice8(c0, p0, len[0] - done);
+	crc[1] = amc_crc_update_slice8(c1, p1, len[1] - done);
+	crc[2] = amc_crc_update_slice8(c2, p2, len[2] - done);
+	crc[3] = amc_crc_update_slice8(c3, p3, len[3] - done);
+}
+
+#ifdef AMC_CRC_HAVE_CLMUL
+#include <cpuid.h>
+#include <immintrin.h>
+
+/* Folding constants, x^n mod P for the fold distances used below. Filled
+in by amc_crc_init. */
+static uint64_t crc_k128, crc_k192, crc_k512, crc_k576;
+
+/**
+\brief Compute x^n mod P(x) for the AMC CRC polynomial
+\param n Power of x
+*/
+static uint64_t crc_xpow_mod(int n)
+{
+	uint32_t r = 1;
+
+	while (n--) {
+		r <<= 1;
+		if (r & 0x10000) {
+			r ^= 0x10000 | AMC_CRC_POLY;
+		}
+	}
+	return r;
+}
+
+/**
+\brief Fold a 128-bit remainder forward by the distance encoded in k
+\param x Current 128-bit remainder
+\param k Folding constants, x^(d+64) mod P in the high and x^d mod P in
+the low quadword, for a fold distance of d bits
+*/
+__attribute__((target("pclmul,ssse3")))
+static inline __m128i crc_fold(__m128i x, __m128i k)
+{
+	return _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x11),
+		_mm_clmulepi64_si128(x, k, 0x00));
+}
+
+/**
+\brief Update a CRC with a block of data using carry-less multiplication
+\param crc CRC accumulated over previous data, 0 to start a new CRC
+\param *buf Data to add to the CRC
+\param len Number of bytes in *buf
+\return Updated CRC, in host byte ordering
+
+Folds the message 64 bytes at a time into four 128-bit remainders with
+PCLMULQDQ, then into a single remainder, and reduces that through the
+table engine. The data is byte-reversed on load so that bit 127 of each
+register is the first bit on the wire, matching the MSB-first CRC used by
+the drives. Short buffers and the trailing bytes go through
+amc_crc_update_slice8. Must only be called if amc_crc_have_clmul()
+returns nonzero.
+*/
+__attribute__((target("pclmul,ssse3")))
+uint16_t amc_crc_update_clmul(uint16_t crc, const void *buf, size_t len)
+{
+	const uint8_t *p = (const uint8_t *)buf;
+	const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+		8, 9, 10, 11, 12, 13, 14, 15);
+	__m128i k1 = _mm_set_epi64x(crc_k192, crc_k128);
+	__m128i k4 = _mm_set_epi64x(crc_k576, crc_k512);
+	__m128i x0, x1, x2, x3;
+	uint8_t rem[16];
+
+	if (len < 64) {
+		return amc_crc_update_slice8(crc, buf, len);
+	}
+
+	x0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 0)), bswap);
+	x1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 16)), bswap);
+	x2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 32)), bswap);
+	x3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 48)), bswap);
+	/* The incoming CRC lines up with the first 16 bits of the message */
+	x0 = _mm_xor_si128(x0, _mm_set_epi64x((uint64_t)crc << 48, 0));
+	p += 64;
+	len -= 64;
+
+	while (len >= 64) {
+		x0 = _mm_xor_si128(crc_fold(x0, k4),
+			_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 0)), bswap));
+		x1 = _mm_xor_si128(crc_fold(x1, k4),
+			_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 16)), bswap));
+		x2 = _mm_xor_si128(crc_fold(x2, k4),
+			_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 32)), bswap));
+		x3 = _mm_xor_si128(crc_fold(x3, k4),
+			_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 48)), bswap));
+		p += 64;
+		len -= 64;
+	}
+
+	x0 = _mm_xor_si128(crc_fold(x0, k1), x1);
+	x0 = _mm_xor_si128(crc_fold(x0, k1), x2);
+	x0 = _mm_xor_si128(crc_fold(x0, k1), x3);
+
+	while (len >= 16) {
+		x0 = _mm_xor_si128(crc_fold(x0, k1),
+			_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)p), bswap));
+		p += 16;
+		len -= 16;
+	}
+
+	/* The remainder is congruent to the message folded so far, so its
+	CRC is the CRC of the message */
+	_mm_storeu_si128((__m128i *)rem, _mm_shuffle_epi8(x0, bswap));
+	crc = amc_crc_update_slice8(0, rem, sizeof(rem));
+	return amc_crc_update_slice8(crc, p, len);
+}
+#endif /* AMC_CRC_HAVE_CLMUL */
+
+static uint16_t (*crc_update_bulk)(uint16_t, const void *, size_t) = amc_crc_update_slice8;
+
+/**
+\brief Check whether the carry-less multiply CRC engine can be used
+\return 1 if amc_crc_update_clmul is usable on this CPU, 0 otherwise
+*/
+int amc_crc_have_clmul(void)
+{
+#ifdef AMC_CRC_HAVE_CLMUL
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+		return 0;
+	}
+	return (ecx & bit_PCLMUL) && (ecx & bit_SSSE3);
+#else
+	return 0;
+#endif
+}
+
+/**
+\brief Select the CRC engine used by amc_crc_update
+
+Runs once when the library is loaded. Picks the carry-less multiply
+engine if the CPU supports it, otherwise the slicing-by-8 table engine.
+*/
+__attribute__((constructor))
+static void amc_crc_init(void)
+{
+#ifdef AMC_CRC_HAVE_CLMUL
+	crc_k128 = crc_xpow_mod(128);
+	crc_k192 = crc_xpow_mod(192);
+	crc_k512 = crc_xpow_mod(512);
+	crc_k576 = crc_xpow_mod(576);
+	if (amc_crc_have_clmul()) {
+		crc_update_bulk = amc_crc_update_clmul;
+	}
+#endif
+}
+
+/**
+\brief Update a CRC with a block of data
+\param crc CRC accumulated over previous data, 0 to start a new CRC
+\param *buf Data to add to the CRC
+\param len Number of bytes in *buf
+\return Updated CRC, in host byte ordering
+
+Computes the same CRC as calling amc_crc_check_word once per byte. Frame
+headers and short payloads are handled inline by the table engine, longer
+buffers go to the fastest engine available on this CPU, selected at
+library load time.
+*/
+uint16_t amc_crc_update(uint16_t crc, const void *buf, size_t len)
+{
+	if (len < AMC_CRC_BULK_MIN) {
+		return amc_crc_update_slice8(crc, buf, len);
+	}
+	return crc_update_bulk(crc, buf, len);
+}
+
+/**
+\brief Get the shared CRC lookup table for AMC_CRC_POLY
+\return Pointer to a read-only 256 entry table, suitable for amc_crc_check_word
+
+The table is generated at build time and shared by all drives, it must not
+be freed.
+*/
+const uint16_t *amc_crc_table(void)
+{
+	return crc_table[0];
+}
@@ -8,9 +8,30 @@
 #define _CRC_H_
 
 #include <stdint.h>
+#include <stddef.h>
 
-void amc_crc_check_word(uint16_t data, uint16_t *accumulator, uint16_t *crc_table);
+/* CRC-16/XMODEM polynomial, also in amc.h for applications. crctable.h is
+generated from this definition alone, see Makefile.am */
+#define AMC_CRC_POLY 0x1021
+
+/* Carry-less multiply engine, only built for x86-64 */
+#if defined(__x86_64__) && defined(__GNUC__)
+#define AMC_CRC_HAVE_CLMUL
+#endif
+
+/* Buffers shorter than this always use the table engine */
+#define AMC_CRC_BULK_MIN 64
+
+void amc_crc_check_word(uint16_t data, uint16_t *accumulator, const uint16_t *table);
 unsigned short *amc_crc_mktable(uint16_t poly);
+const uint16_t *amc_crc_table(void);
+uint16_t amc_crc_update(uint16_t crc, const void *buf, size_t len);
+uint16_t amc_crc_update_slice8(uint16_t crc, const void *buf, size_t len);
+#ifdef AMC_CRC_HAVE_CLMUL
+uint16_t amc_crc_update_clmul(uint16_t crc, const void *buf, size_t len);
+#endif
+int amc_crc_have_clmul(void);
+void amc_crc_update_x4(uint16_t *crc, const void *const *buf, const size_t *len);
 
 #endif /* _CRC_H_ */
 
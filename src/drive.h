@@ -0,0 +1,15 @@
+/**
+\file drive.h
+\brief Drive bookkeeping shared by the synchronous and event driven paths
+\author Jim George
+*/
+
+#ifndef _DRIVE_H_
+#define _DRIVE_H_
+
+struct amc_drive;
+
+void amc_count_result(struct amc_drive *drv, int ret);
+int amc_recoverable(int ret);
+
+#endif /* _DRIVE_H_ */
@@ -0,0 +1,340 @@
+/**
+\file src/fault.c
+\brief Fault-injecting transport for the AMC drive library
+\author Jim George
+
+Wraps another transport and damages what is read through it: single bit
+flips, lost and repeated bytes, reads cut short, bytes held back, and
+stale responses carrying the sequence number of the previous
+transaction. Commands are passed through untouched.
+
+Received bytes are pulled from the underlying transport when waiting for
+data, damaged, and queued until they are read. Waiting only reports the
+port readable once undamaged or damaged bytes are actually queued and
+released, so a read never comes back empty after a successful wait, just
+as with a real port. Faults are drawn from a seeded generator, so a run
+can be repeated exactly against a deterministic peer such as the
+simulator in tests/.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "amc.h"
+#include "crc.h"
+
+/* Largest chunk taken from the underlying transport at once */
+#define AMC_FAULT_CHUNK 512
+
+/**
+\brief Next pseudo-random number (xorshift64*)
+*/
+static uint32_t amc_fault_rand(struct amc_fault *f)
+{
+	f->rng ^= f->rng >> 12;
+	f->rng ^= f->rng << 25;
+	f->rng ^= f->rng >> 27;
+	return (uint32_t)((f->rng * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+/**
+\brief Decide whether a fault happens
+\param *f Fault injector
+\param ppm Probability in parts per million
+\return Nonzero if the fault happens
+*/
+static int amc_fault_chance(struct amc_fault *f, int ppm)
+{
+	return (ppm > 0) && (amc_fault_rand(f) % 1000000 < (uint32_t)ppm);
+}
+
+static void amc_fault_push(struct amc_fault *f, const void *data, int len)
+{
+	if (len > AMC_FAULT_QUEUE_SIZE - f->queue_len) {
+		len = AMC_FAULT_QUEUE_SIZE - f->queue_len;
+	}
+	memcpy(f->queue + f->queue_len, data, len);
+	f->queue_len += len;
+}
+
+/**
+\brief Queue a copy of the previous response, as an acknowledgement
+
+The stale frame is made to carry no payload so that it is exactly one
+header long, with a valid CRC: the library must reject it on its
+sequence number alone.
+*/
+static void amc_fault_push_stale(struct amc_fault *f)
+{
+	struct amc_response stale = f->last_hdr;
+
+	if (stale.status1 == AMC_CMDRESP_COMPLETE && (stale.control.bits.cmd & 0x02)) {
+		stale.control.bits.cmd = AMC_CMDTYPE_READ;
+		stale.payload_len = 0;
+		stale.crc = htons(amc_crc_update(0, &stale, sizeof(stale) - sizeof(uint16_t)));
+	}
+	amc_fault_push(f, &stale, sizeof(stale));
+	f->stats.stale++;
+}
+
+/**
+\brief Damage bytes read from the underlying transport and queue them
+\param *f Fault injector
+\param *data Bytes as read
+\param len Number of bytes
+*/
+static void amc_fault_process(struct amc_fault *f, const uint8_t *data, int len)
+{
+	int ctr;
+
+	f->stats.bytes += len;
+
+	/* Remember the real header, to replay as a stale response later */
+	for (ctr = 0; ctr < len && f->hdr_len < sizeof(struct amc_response); ctr++) {
+		((uint8_t *)&f->hdr)[f->hdr_len++] = data[ctr];
+	}
+
+	if (f->frame_start) {
+		f->frame_start = 0;
+		if (f->have_last && amc_fault_chance(f, f->cfg.stale_ppm)) {
+			amc_fault_push_stale(f);
+		}
+	}
+	if (len > 1 && amc_fault_chance(f, f->cfg.truncate_ppm)) {
+		len = amc_fault_rand(f) % len;
+		f->stats.truncations++;
+	}
+	if (amc_fault_chance(f, f->cfg.delay_ppm)) {
+		clock_gettime(CLOCK_MONOTONIC, &f->hold_until);
+		f->hold_until.tv_sec += f->cfg.delay_us / 1000000;
+		f->hold_until.tv_nsec += (f->cfg.delay_us % 1000000) * 1000L;
+		if (f->hold_until.tv_nsec >= 1000000000L) {
+			f->hold_until.tv_sec++;
+			f->hold_until.tv_nsec -= 1000000000L;
+		}
+		f->stats.delays++;
+	}
+
+	for (ctr = 0; ctr < len; ctr++) {
+		uint8_t byte = data[ctr];
+		if (amc_fault_chance(f, f->cfg.drop_ppm)) {
+			f->stats.drops++;
+			continue;
+		}
+		if (amc_fault_chance(f, f->cfg.flip_ppm)) {
+			byte ^= 1 << (amc_fault_rand(f) % 8);
+			f->stats.flips++;
+		}
+		amc_fault_push(f, &byte, 1);
+		if (amc_fault_chance(f, f->cfg.dup_ppm)) {
+			amc_fault_push(f, &byte, 1);
+			f->stats.dups++;
+		}
+	}
+}
+
+/**
+\brief Read a chunk from the underlying transport and queue it
+\return Bytes read, 0 or -1 as returned by the underlying transport
+*/
+static ssize_t amc_fault_pull(struct amc_fault *f)
+{
+	uint8_t chunk[AMC_FAULT_CHUNK];
+	struct iovec iov;
+	ssize_t ret;
+
+	/* Room for every byte doubled plus a stale header */
+	iov.iov_base = chunk;
+	iov.iov_len = (AMC_FAULT_QUEUE_SIZE - f->queue_len - sizeof(struct amc_response)) / 2;
+	if (iov.iov_len > sizeof(chunk)) {
+		iov.iov_len = sizeof(chunk);
+	}
+	if (iov.iov_len == 0) {
+		errno = ENOBUFS;
+		return -1;
+	}
+	ret = f->lower->ops->readv(f->lower, &iov, 1);
+	if (ret > 0) {
+		amc_fault_process(f, chunk, ret);
+	}
+	return ret;
+}
+
+/**
+\brief Time left until a point in time, zero if it has passed
+*/
+static struct timespec amc_fault_until(const struct timespec *when)
+{
+	struct timespec now, left;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	left.tv_sec = when->tv_sec - now.tv_sec;
+	left.tv_nsec = when->tv_nsec - now.tv_nsec;
+	if (left.tv_nsec < 0) {
+		left.tv_sec--;
+		left.tv_nsec += 1000000000L;
+	}
+	if (left.tv_sec < 0) {
+		left.tv_sec = left.tv_nsec = 0;
+	}
+	return left;
+}
+
+static int amc_fault_held(const struct amc_fault *f)
+{
+	struct timespec left = amc_fault_until(&f->hold_until);
+	return left.tv_sec > 0 || left.tv_nsec > 0;
+}
+
+static ssize_t amc_fault_writev(struct amc_transport *xprt, const struct iovec *iov, int iovcnt)
+{
+	struct amc_fault *f = xprt->priv;
+
+	/* A new command, the next bytes read are its response */
+	if (f->hdr_len == sizeof(struct amc_response)) {
+		f->last_hdr = f->hdr;
+		f->have_last = 1;
+	}
+	f->hdr_len = 0;
+	f->frame_start = 1;
+	f->lower->deadline = xprt->deadline;
+	return f->lower->ops->writev(f->lower, iov, iovcnt);
+}
+
+static ssize_t amc_fault_readv(struct amc_transport *xprt, const struct iovec *iov, int iovcnt)
+{
+	struct amc_fault *f = xprt->priv;
+	int part, copied = 0;
+
+	while (f->queue_len == 0) {
+		ssize_t ret = amc_fault_pull(f);
+		if (ret <= 0) {
+			return ret;
+		}
+	}
+	if (amc_fault_held(f)) {
+		errno = EAGAIN;
+		return -1;
+	}
+	for (part = 0; part < iovcnt && copied < f->queue_len; part++) {
+		int len = f->queue_len - copied;
+		if (len > iov[part].iov_len) {
+			len = iov[part].iov_len;
+		}
+		memcpy(iov[part].iov_base, f->queue + copied, len);
+		copied += len;
+	}
+	memmove(f->queue, f->queue + copied, f->queue_len - copied);
+	f->queue_len -= copied;
+	return copied;
+}
+
+static int amc_fault_wait(struct amc_transport *xprt, const struct timespec *timeout)
+{
+	struct amc_fault *f = xprt->priv;
+	struct timespec end, left;
+	int ret;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	end.tv_sec += timeout->tv_sec;
+	end.tv_nsec += timeout->tv_nsec;
+	if (end.tv_nsec >= 1000000000L) {
+		end.tv_sec++;
+		end.tv_nsec -= 1000000000L;
+	}
+
+	for (;;) {
+		if (f->queue_len > 0) {
+			struct timespec hold = amc_fault_until(&f->hold_until);
+			left = amc_fault_until(&end);
+			if (hold.tv_sec == 0 && hold.tv_nsec == 0) {
+				return 1;
+			}
+			/* Sleep out the hold, or as much of it as the timeout allows */
+			if (hold.tv_sec > left.tv_sec ||
+				(hold.tv_sec == left.tv_sec && hold.tv_nsec > left.tv_nsec)) {
+				nanosleep(&left, NULL);
+				return 0;
+			}
+			nanosleep(&hold, NULL);
+			continue;
+		}
+		left = amc_fault_until(&end);
+		ret = f->lower->ops->wait(f->lower, &left);
+		if (ret <= 0) {
+			return ret;
+		}
+		ret = amc_fault_pull(f);
+		if (ret == 0) {
+			/* Readable but nothing to read: the far end has hung up */
+			errno = EIO;
+		}
+		if (ret <= 0) {
+			return -1;
+		}
+	}
+}
+
+static void amc_fault_flush(struct amc_transport *xprt)
+{
+	struct amc_fault *f = xprt->priv;
+
+	f->queue_len = 0;
+	f->hold_until.tv_sec = f->hold_until.tv_nsec = 0;
+	f->lower->ops->flush(f->lower);
+}
+
+static void amc_fault_close(struct amc_transport *xprt)
+{
+	struct amc_fault *f = xprt->priv;
+
+	if (f->lower->ops->close != NULL) {
+		f->lower->ops->close(f->lower);
+	}
+}
+
+static const struct amc_transport_ops amc_fault_ops = {
+	.writev = amc_fault_writev,
+	.readv = amc_fault_readv,
+	.wait = amc_fault_wait,
+	.flush = amc_fault_flush,
+	.close = amc_fault_close
+};
+
+/**
+\brief Set up a transport that injects faults into another one
+\param *f Fault injector to initialize
+\param *lower Transport to wrap, must outlive *f
+\param *cfg Faults to inject, copied
+
+Create drives on &f->xprt. Faults can be changed later through f->cfg and
+are counted in f->stats. Closing the fault transport closes the wrapped
+one. The underlying file descriptor is passed through, so drives still
+read back the baud rate of the port.
+*/
+void amc_fault_init(struct amc_fault *f, struct amc_transport *lower,
+	const struct amc_fault_config *cfg)
+{
+	uint64_t seed;
+
+	assert(f != NULL);
+	assert(lower != NULL && lower->ops != NULL);
+	assert(cfg != NULL);
+
+	memset(f, 0, sizeof(struct amc_fault));
+	f->xprt.ops = &amc_fault_ops;
+	f->xprt.fd = lower->fd;
+	f->xprt.priv = f;
+	f->lower = lower;
+	f->cfg = *cfg;
+
+	/* splitmix64 of the seed, xorshift must not start from zero */
+	seed = cfg->seed + 0x9E3779B97F4A7C15ULL;
+	seed = (seed ^ (seed >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	seed = (seed ^ (seed >> 27)) * 0x94D049BB133111EBULL;
+	f->rng = (seed ^ (seed >> 31)) | 1;
+}
@@ -0,0 +1,735 @@
+/**
+\file src/loop.c
+\brief Single threaded event loop for many ports
+\author Jim George
+
+The blocking calls in amc.c tie up a thread per port for the length of
+every transaction. An event loop instead owns any number of ports, puts
+their descriptors in nonblocking mode and registers them with one epoll
+instance, and moves each port's current transaction through a small
+state machine as the port becomes writable or readable:
+
+	IDLE -> SEND -> RECV -> IDLE
+	                  \-> DRAIN -> SEND (retry) or IDLE
+
+SEND writes the command frame, continuing on EPOLLOUT if the port only
+takes part of it. RECV feeds whatever arrives to an incremental decoder
+(parser.c) until the response is complete. DRAIN is amc_recover without
+the blocking: input is thrown away until the line has been quiet for
+drv->retry.quiet_us, then the port is flushed and a read is retried.
+Transaction and drain deadlines are kept on a timerfd in the same epoll
+set, so a single descriptor tells when the loop has work to do.
+
+Applications with a loop of their own watch amc_loop_fd for input and
+call amc_loop_dispatch(loop, 0) when it fires. Otherwise call
+amc_loop_dispatch with a timeout until amc_loop_pending is zero.
+
+Transactions on one port run one at a time in the order submitted, the
+protocol allows only one outstanding command per line. Ports must be
+transports that read and write their file descriptor directly (the tty
+and TCP transports). While a port is in a loop its drives must not be
+used with the blocking calls.
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <assert.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "amc.h"
+#include "drive.h"
+
+#define AMC_LOOP_IDLE 0
+#define AMC_LOOP_SEND 1
+#define AMC_LOOP_RECV 2
+#define AMC_LOOP_DRAIN 3
+
+/* Largest command frame, header plus payload and its CRC */
+#define AMC_LOOP_TX_SIZE (sizeof(struct amc_command) + AMC_MAX_PAYLOAD + sizeof(uint16_t))
+
+/* Bytes read from a port at once, and events handled per epoll_wait */
+#define AMC_LOOP_CHUNK 512
+#define AMC_LOOP_EVENTS 64
+
+struct amc_loop_port {
+	struct amc_loop *loop; /**< Loop the port belongs to */
+	struct amc_transport *xprt; /**< Transport of the port */
+	int fd_flags; /**< File status flags before the port was added */
+	int stream; /**< Nonzero for a socket, where reading 0 bytes means the peer hung up */
+	int state; /**< One of AMC_LOOP_* */
+	int out_armed; /**< Nonzero while EPOLLOUT is watched */
+	int failed; /**< The port hung up or failed, AMC_E* error */
+	struct amc_loop_txn *cur; /**< Transaction in progress */
+	struct amc_loop_txn *head, *tail; /**< Transactions waiting */
+	int pending_ret; /**< Error being recovered from in DRAIN */
+	int tx_len; /**< Length of the command frame */
+	int tx_sent; /**< Bytes of the command frame written */
+	struct timespec quiet_until; /**< DRAIN ends once the line is quiet until this */
+	struct timespec drain_end; /**< DRAIN ends at this time regardless */
+	struct amc_parser parser; /**< Response decoder */
+	uint8_t tx[AMC_LOOP_TX_SIZE]; /**< Command frame */
+};
+
+struct amc_loop {
+	int epfd; /**< epoll instance */
+	int timerfd; /**< Fires at the earliest deadline of any port */
+	struct timespec timer; /**< Time timerfd is set to, zero if disarmed */
+	struct amc_loop_port **ports; /**< Ports in the loop */
+	int nports; /**< Number of ports */
+	int pending; /**< Transactions submitted and not completed */
+	int completed; /**< Transactions completed by the current dispatch */
+};
+
+static void amc_loop_start(struct amc_loop_port *port);
+
+static int amc_loop_before(const struct timespec *a, const struct timespec *b)
+{
+	return (a->tv_sec < b->tv_sec) || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static void amc_loop_after_us(struct timespec *ts, const struct timespec *now, int us)
+{
+	ts->tv_sec = now->tv_sec + us / 1000000;
+	ts->tv_nsec = now->tv_nsec + (us % 1000000) * 1000L;
+	if (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000L;
+	}
+}
+
+/**
+\brief Watch a port for being writable, or stop doing so
+*/
+static void amc_loop_watch_out(struct amc_loop_port *port, int out)
+{
+	struct epoll_event ev;
+
+	if (port->out_armed == out || port->failed) {
+		return;
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | (out ? EPOLLOUT : 0);
+	ev.data.ptr = port;
+	epoll_ctl(port->loop->epfd, EPOLL_CTL_MOD, port->xprt->fd, &ev);
+	port->out_armed = out;
+}
+
+/**
+\brief Finish the current transaction of a port and start the next one
+\param *port Port
+\param ret Result handed to the transaction
+*/
+static void amc_loop_complete(struct amc_loop_port *port, int ret)
+{
+	struct amc_loop_txn *txn = port->cur;
+
+	port->cur = NULL;
+	port->state = AMC_LOOP_IDLE;
+	amc_loop_watch_out(port, 0);
+	txn->drv->deadline_set = 0;
+	txn->drv->rx_expect = -1;
+	txn->result = ret;
+	port->loop->pending--;
+	port->loop->completed++;
+	if (txn->done != NULL) {
+		txn->done(txn);
+	}
+	amc_loop_start(port);
+}
+
+/**
+\brief Write as much of the command frame as the port takes
+*/
+static void amc_loop_write(struct amc_loop_port *port)
+{
+	while (port->tx_sent < port->tx_len) {
+		struct iovec iov;
+		ssize_t ret;
+
+		iov.iov_base = port->tx + port->tx_sent;
+		iov.iov_len = port->tx_len - port->tx_sent;
+		ret = port->xprt->ops->writev(port->xprt, &iov, 1);
+		if (ret > 0) {
+			port->tx_sent += ret;
+		}
+		else if (ret == -1 && errno == EINTR) {
+			continue;
+		}
+		else if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			amc_loop_watch_out(port, 1);
+			return;
+		}
+		else {
+			amc_loop_complete(port, AMC_EWRITE);
+			return;
+		}
+	}
+	amc_loop_watch_out(port, 0);
+	port->state = AMC_LOOP_RECV;
+}
+
+/**
+\brief Encode the command of the current transaction and start sending it
+*/
+static void amc_loop_send(struct amc_loop_port *port)
+{
+	struct amc_loop_txn *txn = port->cur;
+	struct amc_command cmd;
+	uint16_t payload_crc = 0;
+	int ret;
+
+	cmd.index = txn->index;
+	cmd.offset = txn->offset;
+	ret = amc_cmd_encode(txn->drv, &cmd, txn->access_type, txn->buffer_len,
+		txn->payload, txn->payload_len, &payload_crc);
+	if (ret < 0) {
+		amc_loop_complete(port, ret);
+		return;
+	}
+	if (ret > AMC_LOOP_TX_SIZE) {
+		amc_loop_complete(port, AMC_EBUFSIZE);
+		return;
+	}
+	memcpy(port->tx, &cmd, sizeof(cmd));
+	if (txn->payload_len > 0) {
+		memcpy(port->tx + sizeof(cmd), txn->payload, txn->payload_len);
+		memcpy(port->tx + sizeof(cmd) + txn->payload_len, &payload_crc, sizeof(payload_crc));
+	}
+	port->tx_len = ret;
+	port->tx_sent = 0;
+
+	amc_parser_init(&port->parser);
+	if (txn->buffer != NULL) {
+		amc_parser_set_payload(&port->parser, txn->buffer, txn->buffer_len);
+	}
+	else {
+		amc_parser_set_payload(&port->parser, port->parser.buffer, 0);
+	}
+	port->state = AMC_LOOP_SEND;
+	amc_loop_write(port);
+}
+
+static void amc_loop_start(struct amc_loop_port *port)
+{
+	if (port->state != AMC_LOOP_IDLE || port->head == NULL || port->failed) {
+		return;
+	}
+	port->cur = port->head;
+	port->head = port->head->next;
+	if (port->head == NULL) {
+		port->tail = NULL;
+	}
+	amc_loop_send(port);
+}
+
+/**
+\brief Act on the outcome of a response, as amc_get_string does
+\param *port Port
+\param ret Result of reading the response
+*/
+static void amc_loop_result(struct amc_loop_port *port, int ret)
+{
+	struct amc_loop_txn *txn = port->cur;
+	struct amc_drive *drv = txn->drv;
+	struct timespec now;
+
+	amc_count_result(drv, ret);
+	drv->deadline_set = 0;
+	if (ret >= 0) {
+		amc_loop_complete(port, ret);
+		return;
+	}
+	if (!amc_recoverable(ret) && ret != AMC_EBUFSIZE) {
+		if (txn->access_type == AMC_CMDTYPE_READ) {
+			drv->bus->stats.failures++;
+		}
+		amc_loop_complete(port, ret);
+		return;
+	}
+
+	/* Drain the line before the next command, as amc_recover does. A
+	payload too large for the buffer is drained too, but not retried */
+	if (ret != AMC_EBUFSIZE) {
+		drv->bus->stats.recoveries++;
+	}
+	port->pending_ret = ret;
+	port->state = AMC_LOOP_DRAIN;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	amc_loop_after_us(&port->quiet_until, &now, drv->retry.quiet_us);
+	amc_loop_after_us(&port->drain_end, &now, drv->retry.drain_max_us);
+}
+
+/**
+\brief End a drain, then retry the read or give up
+*/
+static void amc_loop_drained(struct amc_loop_port *port)
+{
+	struct amc_loop_txn *txn = port->cur;
+	struct amc_drive *drv = txn->drv;
+
+	port->xprt->ops->flush(port->xprt);
+	if (txn->access_type == AMC_CMDTYPE_READ) {
+		if (port->pending_ret != AMC_EBUFSIZE && txn->attempt < drv->retry.max_retries) {
+			txn->attempt++;
+			drv->bus->stats.retries++;
+			amc_loop_send(port);
+			return;
+		}
+		drv->bus->stats.failures++;
+	}
+	amc_loop_complete(port, port->pending_ret);
+}
+
+/**
+\brief Handle bytes read from a port
+*/
+static void amc_loop_input(struct amc_loop_port *port, const uint8_t *data, int len)
+{
+	struct amc_parser *p = &port->parser;
+	struct timespec now;
+	int used = 0, n, ret;
+
+	switch (port->state) {
+	case AMC_LOOP_RECV:
+		while (used < len) {
+			ret = amc_parser_push(p, data + used, len - used, &n);
+			used += n;
+			if (ret == 0) {
+				continue;
+			}
+			if (ret == 1) {
+				ret = amc_resp_check_header(port->cur->drv, &p->rsp);
+				if (ret == AMC_EOK) {
+					ret = sizeof(struct amc_response) + p->payload_size;
+				}
+			}
+			/* Anything after the response is noise, there is only one
+			command outstanding */
+			port->cur->drv->bus->stats.drained += len - used;
+			amc_loop_result(port, ret);
+			return;
+		}
+		break;
+	case AMC_LOOP_DRAIN:
+		port->cur->drv->bus->stats.drained += len;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		amc_loop_after_us(&port->quiet_until, &now, port->cur->drv->retry.quiet_us);
+		break;
+	default:
+		/* Nothing asked for, throw it away */
+		break;
+	}
+}
+
+/**
+\brief Take a failed port out of service and fail its transactions
+\param *port Port
+\param ret Error handed to the transactions
+*/
+static void amc_loop_fail_port(struct amc_loop_port *port, int ret)
+{
+	if (!port->failed) {
+		epoll_ctl(port->loop->epfd, EPOLL_CTL_DEL, port->xprt->fd, NULL);
+		port->failed = ret;
+	}
+	if (port->cur != NULL) {
+		amc_loop_complete(port, ret);
+	}
+	while (port->head != NULL) {
+		port->cur = port->head;
+		port->head = port->head->next;
+		amc_loop_complete(port, ret);
+	}
+	port->tail = NULL;
+}
+
+/**
+\brief Read everything a port has available
+\param *port Port
+\param events Events epoll reported for the port
+
+A tty read finds no data with 0 as often as with EAGAIN (for instance
+with AMC_SERIAL_POLLED_READ, which sets VMIN and VTIME to 0), so a tty
+is only taken to have hung up when epoll says so. On a socket, 0 is the
+end of the stream.
+*/
+static void amc_loop_read(struct amc_loop_port *port, uint32_t events)
+{
+	uint8_t chunk[AMC_LOOP_CHUNK];
+	struct iovec iov;
+	ssize_t ret;
+
+	iov.iov_base = chunk;
+	iov.iov_len = sizeof(chunk);
+	for (;;) {
+		ret = port->xprt->ops->readv(port->xprt, &iov, 1);
+		if (ret > 0) {
+			amc_loop_input(port, chunk, ret);
+			if (ret < sizeof(chunk)) {
+				return;
+			}
+		}
+		else if (ret == -1 && errno == EINTR) {
+			continue;
+		}
+		else if ((ret == 0 && !port->stream) ||
+			(ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))) {
+			if (events & (EPOLLHUP | EPOLLERR)) {
+				amc_loop_fail_port(port, AMC_EREAD);
+			}
+			return;
+		}
+		else {
+			/* Hung up, or a hard error */
+			amc_loop_fail_port(port, AMC_EREAD);
+			return;
+		}
+	}
+}
+
+/**
+\brief Get the time by which a port needs attention
+\return Nonzero if the port has a deadline
+*/
+static int amc_loop_port_deadline(const struct amc_loop_port *port, struct timespec *when)
+{
+	switch (port->state) {
+	case AMC_LOOP_SEND:
+	case AMC_LOOP_RECV:
+		*when = port->cur->drv->deadline;
+		return 1;
+	case AMC_LOOP_DRAIN:
+		*when = amc_loop_before(&port->quiet_until, &port->drain_end) ?
+			port->quiet_until : port->drain_end;
+		return 1;
+	}
+	return 0;
+}
+
+/**
+\brief Time out transactions and end drains that are due
+*/
+static void amc_loop_expire(struct amc_loop *loop)
+{
+	struct timespec now, when;
+	int ctr;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (ctr = 0; ctr < loop->nports; ctr++) {
+		struct amc_loop_port *port = loop->ports[ctr];
+		if (!amc_loop_port_deadline(port, &when) || amc_loop_before(&now, &when)) {
+			continue;
+		}
+		if (port->state == AMC_LOOP_DRAIN) {
+			amc_loop_drained(port);
+		}
+		else {
+			amc_loop_result(port, AMC_ETIMEOUT);
+		}
+	}
+}
+
+/**
+\brief Set the timer to the earliest deadline of any port
+*/
+static void amc_loop_arm(struct amc_loop *loop)
+{
+	struct itimerspec its;
+	struct timespec when;
+	int ctr, have = 0;
+
+	memset(&its, 0, sizeof(its));
+	for (ctr = 0; ctr < loop->nports; ctr++) {
+		if (amc_loop_port_deadline(loop->ports[ctr], &when) &&
+			(!have || amc_loop_before(&when, &its.it_value))) {
+			its.it_value = when;
+			have = 1;
+		}
+	}
+	if (its.it_value.tv_sec == loop->timer.tv_sec && its.it_value.tv_nsec == loop->timer.tv_nsec) {
+		return;
+	}
+	/* A deadline of exactly zero would disarm the timer */
+	if (have && its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0) {
+		its.it_value.tv_nsec = 1;
+	}
+	timerfd_settime(loop->timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+	loop->timer = its.it_value;
+}
+
+static struct amc_loop_port *amc_loop_find(const struct amc_loop *loop,
+	const struct amc_transport *xprt)
+{
+	int ctr;
+
+	for (ctr = 0; ctr < loop->nports; ctr++) {
+		if (loop->ports[ctr]->xprt == xprt) {
+			return loop->ports[ctr];
+		}
+	}
+	return NULL;
+}
+
+/**
+\brief Create an event loop
+\return The loop, or NULL with errno set on failure
+
+Free with amc_loop_free.
+*/
+struct amc_loop *amc_loop_new(void)
+{
+	struct amc_loop *loop = calloc(1, sizeof(struct amc_loop));
+	struct epoll_event ev;
+
+	if (loop == NULL) {
+		return NULL;
+	}
+	loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+	loop->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (loop->epfd == -1 || loop->timerfd == -1) {
+		goto fail;
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->timerfd, &ev)) {
+		goto fail;
+	}
+	return loop;
+
+fail:
+	if (loop->epfd != -1) {
+		close(loop->epfd);
+	}
+	if (loop->timerfd != -1) {
+		close(loop->timerfd);
+	}
+	free(loop);
+	return NULL;
+}
+
+/**
+\brief Destroy an event loop
+\param *loop Loop to destroy, can be NULL
+
+Removes every port as amc_loop_remove_port does, so transactions still
+queued complete with AMC_ECANCELED. The transports are not closed.
+*/
+void amc_loop_free(struct amc_loop *loop)
+{
+	if (loop == NULL) {
+		return;
+	}
+	while (loop->nports > 0) {
+		amc_loop_remove_port(loop, loop->ports[loop->nports - 1]->xprt);
+	}
+	close(loop->timerfd);
+	close(loop->epfd);
+	free(loop->ports);
+	free(loop);
+}
+
+/**
+\brief Add a port to an event loop
+\param *loop Loop
+\param *xprt Transport of the port, with a file descriptor, must stay in
+place until removed
+\return 0 on success, -1 with errno set on failure (EEXIST if the port is
+already in the loop, EBADF if the transport has no file descriptor)
+
+The descriptor is switched to nonblocking mode until the port is removed.
+*/
+int amc_loop_add_port(struct amc_loop *loop, struct amc_transport *xprt)
+{
+	struct amc_loop_port *port, **ports;
+	struct epoll_event ev;
+	struct stat st;
+
+	assert(loop != NULL);
+	assert(xprt != NULL && xprt->ops != NULL);
+
+	if (xprt->fd < 0) {
+		errno = EBADF;
+		return -1;
+	}
+	if (amc_loop_find(loop, xprt) != NULL) {
+		errno = EEXIST;
+		return -1;
+	}
+	ports = realloc(loop->ports, (loop->nports + 1) * sizeof(struct amc_loop_port *));
+	if (ports == NULL) {
+		return -1;
+	}
+	loop->ports = ports;
+	port = calloc(1, sizeof(struct amc_loop_port));
+	if (port == NULL) {
+		return -1;
+	}
+	port->loop = loop;
+	port->xprt = xprt;
+	port->state = AMC_LOOP_IDLE;
+	port->stream = (fstat(xprt->fd, &st) == 0) && S_ISSOCK(st.st_mode);
+	port->fd_flags = fcntl(xprt->fd, F_GETFL);
+	if (port->fd_flags == -1 || fcntl(xprt->fd, F_SETFL, port->fd_flags | O_NONBLOCK)) {
+		free(port);
+		return -1;
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = port;
+	if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, xprt->fd, &ev)) {
+		fcntl(xprt->fd, F_SETFL, port->fd_flags);
+		free(port);
+		return -1;
+	}
+	loop->ports[loop->nports++] = port;
+	return 0;
+}
+
+/**
+\brief Take a port out of an event loop
+\param *loop Loop
+\param *xprt Transport of the port
+\return 0 on success, -1 with errno set to ENOENT if the port is not in
+the loop
+
+Transactions in progress or queued on the port complete with
+AMC_ECANCELED; a command already sent may still be answered, so recover
+the line (amc_recover) before using the port again. The descriptor gets
+its blocking mode back. Must not be called from a completion callback.
+*/
+int amc_loop_remove_port(struct amc_loop *loop, struct amc_transport *xprt)
+{
+	struct amc_loop_port *port;
+	int ctr;
+
+	assert(loop != NULL);
+	port = amc_loop_find(loop, xprt);
+	if (port == NULL) {
+		errno = ENOENT;
+		return -1;
+	}
+	/* Queued transactions fail, new ones are refused */
+	amc_loop_fail_port(port, AMC_ECANCELED);
+	fcntl(xprt->fd, F_SETFL, port->fd_flags);
+
+	for (ctr = 0; ctr < loop->nports; ctr++) {
+		if (loop->ports[ctr] == port) {
+			loop->ports[ctr] = loop->ports[--loop->nports];
+			break;
+		}
+	}
+	free(port);
+	amc_loop_arm(loop);
+	return 0;
+}
+
+/**
+\brief Queue a transaction on an event loop
+\param *loop Loop
+\param *txn Transaction, see struct amc_loop_txn
+\return AMC_EOK if queued, AMC_EPORT if the drive's bus is not on a port in
+the loop, AMC_EREAD if the port has failed
+
+If the port is idle the command is written right away. txn->done may be
+called before this returns, when the command cannot be encoded or sent.
+*/
+int amc_loop_submit(struct amc_loop *loop, struct amc_loop_txn *txn)
+{
+	struct amc_loop_port *port;
+
+	assert(loop != NULL);
+	assert(txn != NULL && txn->drv != NULL);
+
+	port = amc_loop_find(loop, txn->drv->bus->xprt);
+	if (port == NULL) {
+		return AMC_EPORT;
+	}
+	if (port->failed) {
+		return port->failed;
+	}
+	txn->next = NULL;
+	txn->attempt = 0;
+	txn->result = 0;
+	if (port->tail != NULL) {
+		port->tail->next = txn;
+	}
+	else {
+		port->head = txn;
+	}
+	port->tail = txn;
+	loop->pending++;
+	amc_loop_start(port);
+	amc_loop_arm(loop);
+	return AMC_EOK;
+}
+
+/**
+\brief Get the descriptor to watch for an event loop
+\param *loop Loop
+\return epoll file descriptor, readable when amc_loop_dispatch has work
+*/
+int amc_loop_fd(const struct amc_loop *loop)
+{
+	assert(loop != NULL);
+	return loop->epfd;
+}
+
+/**
+\brief Handle whatever the ports of an event loop have to offer
+\param *loop Loop
+\param timeout_ms Longest time to wait for an event, 0 to return at once,
+-1 to wait indefinitely
+\return Number of transactions completed, -1 with errno set on failure
+
+Completion callbacks run from here, and may submit further transactions.
+*/
+int amc_loop_dispatch(struct amc_loop *loop, int timeout_ms)
+{
+	struct epoll_event ev[AMC_LOOP_EVENTS];
+	int ctr, count;
+
+	assert(loop != NULL);
+	loop->completed = 0;
+	count = epoll_wait(loop->epfd, ev, AMC_LOOP_EVENTS, timeout_ms);
+	if (count == -1) {
+		return (errno == EINTR) ? 0 : -1;
+	}
+	for (ctr = 0; ctr < count; ctr++) {
+		struct amc_loop_port *port = ev[ctr].data.ptr;
+
+		if (port == NULL) {
+			uint64_t expirations;
+			if (read(loop->timerfd, &expirations, sizeof(expirations)) > 0) {
+				loop->timer.tv_sec = loop->timer.tv_nsec = 0;
+			}
+			continue;
+		}
+		if ((ev[ctr].events & EPOLLOUT) && port->state == AMC_LOOP_SEND) {
+			amc_loop_write(port);
+		}
+		if (ev[ctr].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+			amc_loop_read(port, ev[ctr].events);
+		}
+	}
+	amc_loop_expire(loop);
+	amc_loop_arm(loop);
+	return loop->completed;
+}
+
+/**
+\brief Get the number of transactions that have not completed yet
+\param *loop Loop
+*/
+int amc_loop_pending(const struct amc_loop *loop)
+{
+	assert(loop != NULL);
+	return loop->pending;
+}
@@ -0,0 +1,54 @@
+/**
+\file src/mkcrctable.c
+\brief Generate the CRC lookup tables used by crc.c
+\author Jim George
+
+Build-time helper that writes crctable.h to standard output. The header
+holds the slicing-by-8 tables for the AMC CRC polynomial as const data, so
+the library never builds CRC tables at run time. Regenerate with
+"make crctable.h" after configuring with --enable-maintainer-mode.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include "crc.h"
+
+int main(void)
+{
+	uint16_t table[8][256];
+	int i, k, bit;
+
+	for (i = 0; i < 256; i++) {
+		uint16_t accum = i << 8;
+		for (bit = 0; bit < 8; bit++) {
+			accum = (accum & 0x8000) ? (accum << 1) ^ AMC_CRC_POLY : accum << 1;
+		}
+		table[0][i] = accum;
+	}
+	for (k = 1; k < 8; k++) {
+		for (i = 0; i < 256; i++) {
+			uint16_t prev = table[k - 1][i];
+			table[k][i] = (prev << 8) ^ table[0][prev >> 8];
+		}
+	}
+
+	printf("/**\n"
+		"\\file src/crctable.h\n"
+		"\\brief CRC lookup tables for polynomial 0x%04X\n"
+		"\n"
+		"Generated by mkcrctable, do not edit. crc_table[k][i] is the CRC of\n"
+		"byte i followed by k zero bytes.\n"
+		"*/\n\n", AMC_CRC_POLY);
+	printf("#ifndef _CRCTABLE_H_\n#define _CRCTABLE_H_\n\n");
+	printf("static const uint16_t crc_table[8][256] = {\n");
+	for (k = 0; k < 8; k++) {
+		printf("{\n");
+		for (i = 0; i < 256; i++) {
+			printf("%s0x%04X%s", (i % 8) ? " " : "\t", table[k][i],
+				(i == 255) ? "\n" : ((i % 8) == 7) ? ",\n" : ",");
+		}
+		printf("}%s\n", (k == 7) ? "" : ",");
+	}
+	printf("};\n\n#endif /* _CRCTABLE_H_ */\n");
+	return 0;
+}
@@ -0,0 +1,236 @@
+/**
+\file src/parser.c
+\brief Incremental decoder for AMC response frames
+\author Jim George
+
+Push-style response decoder. Bytes are fed in chunks of any size, as they
+arrive from a blocking read, a nonblocking read or a capture file, and
+complete frames come out with their header and payload CRCs checked.
+
+The decoder keeps no state outside struct amc_parser, so any number of
+them can run side by side. It locks on to a frame by scanning for the
+start of frame byte and confirming the header CRC. If the CRC fails, it
+resumes the scan one byte after the SOF that was rejected, so a stray or
+lost byte on the line only costs the frame it hit.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <arpa/inet.h>
+
+#include "amc.h"
+#include "crc.h"
+
+#define AMC_PARSER_HEADER 0
+#define AMC_PARSER_PAYLOAD 1
+#define AMC_PARSER_SKIP 2
+
+/**
+\brief Initialize a response decoder
+\param *p Decoder to initialize
+
+Payloads are stored in the decoder's own buffer until another one is set
+with amc_parser_set_payload.
+*/
+void amc_parser_init(struct amc_parser *p)
+{
+	assert(p != NULL);
+	memset(p, 0, sizeof(struct amc_parser));
+	p->payload = p->buffer;
+	p->payload_max = sizeof(p->buffer);
+	amc_parser_reset(p);
+}
+
+/**
+\brief Discard any partially decoded frame
+\param *p Decoder to reset
+
+The statistics and the payload buffer are left alone.
+*/
+void amc_parser_reset(struct amc_parser *p)
+{
+	p->state = AMC_PARSER_HEADER;
+	p->count = 0;
+	p->payload_size = 0;
+}
+
+/**
+\brief Set where the decoder stores payloads
+\param *p Decoder
+\param *payload Buffer for payloads, or NULL to use the decoder's own buffer
+\param payload_max Size in bytes of the buffer pointed to by *payload
+
+Frames with a larger payload than payload_max are skipped, and reported
+by amc_parser_push as AMC_EBUFSIZE.
+*/
+void amc_parser_set_payload(struct amc_parser *p, void *payload, int payload_max)
+{
+	if (payload == NULL) {
+		p->payload = p->buffer;
+		p->payload_max = sizeof(p->buffer);
+	}
+	else {
+		p->payload = payload;
+		p->payload_max = payload_max;
+	}
+}
+
+/**
+\brief Get the number of bytes needed to finish the current frame
+\param *p Decoder
+\return Minimum number of bytes before amc_parser_push can complete a frame
+
+Blocking readers can ask for exactly this many bytes, so that they never
+take bytes belonging to the next frame off the line.
+*/
+int amc_parser_wanted(const struct amc_parser *p)
+{
+	switch (p->state) {
+	case AMC_PARSER_PAYLOAD:
+		return p->payload_size + sizeof(uint16_t) - p->count;
+	case AMC_PARSER_SKIP:
+		return p->count;
+	default:
+		return sizeof(struct amc_response) - p->count;
+	}
+}
+
+/**
+\brief Restart the SOF scan after a header failed its CRC check
+\param *p Decoder holding a complete but invalid header
+*/
+static void amc_parser_resync(struct amc_parser *p)
+{
+	uint8_t *hdr = (uint8_t *)&p->rsp;
+	uint8_t *sof = memchr(hdr + 1, AMC_SOF_BYTE, sizeof(struct amc_response) - 1);
+
+	p->resyncs++;
+	if (sof == NULL) {
+		p->discarded += sizeof(struct amc_response);
+		p->count = 0;
+	}
+	else {
+		p->discarded += sof - hdr;
+		p->count = sizeof(struct amc_response) - (sof - hdr);
+		memmove(hdr, sof, p->count);
+	}
+}
+
+/**
+\brief Feed received bytes to the decoder
+\param *p Decoder
+\param *data Received bytes
+\param len Number of bytes at *data
+\param *consumed Location to store the number of bytes used from *data
+\return 1 if a frame was completed, 0 if all bytes were used without
+completing a frame, AMC_ECRC if a frame was completed but its payload CRC
+failed, AMC_EBUFSIZE if a frame's payload does not fit the payload buffer
+
+On return of 1, p->rsp holds the response header and p->payload holds
+p->payload_size bytes of payload (zero if the response carries none).
+The header CRC has been checked, the sequence number and status are left
+to the caller (see amc_resp_check_header). Unused bytes must be fed in
+again, starting at data + *consumed.
+
+A response carries a payload only if it reports success and bit 1 of its
+command type is set, as for amc_resp_read. When AMC_EBUFSIZE is returned
+the header is in p->rsp and the decoder skips the payload as it arrives.
+*/
+int amc_parser_push(struct amc_parser *p, const void *data, int len, int *consumed)
+{
+	const uint8_t *in = (const uint8_t *)data;
+	int used = 0, n;
+
+	assert(p != NULL);
+	assert(consumed != NULL);
+
+	while (used < len) {
+		switch (p->state) {
+		case AMC_PARSER_HEADER:
+			if (p->count == 0) {
+				/* Nothing locked on yet, scan for the start of a frame */
+				const uint8_t *sof = memchr(in + used, AMC_SOF_BYTE, len - used);
+				if (sof == NULL) {
+					p->discarded += len - used;
+					used = len;
+					break;
+				}
+				p->discarded += sof - (in + used);
+				used = sof - in;
+			}
+			n = sizeof(struct amc_response) - p->count;
+			if (n > len - used) n = len - used;
+			memcpy((uint8_t *)&p->rsp + p->count, in + used, n);
+			p->count += n;
+			used += n;
+			if (p->count < sizeof(struct amc_response)) {
+				break;
+			}
+
+			if (amc_crc_update(0, &p->rsp, sizeof(struct amc_response) - sizeof(uint16_t)) !=
+				ntohs(p->rsp.crc)) {
+				amc_parser_resync(p);
+				break;
+			}
+
+			p->count = 0;
+			p->payload_size = 0;
+			if ((p->rsp.status1 == AMC_CMDRESP_COMPLETE) && (p->rsp.control.bits.cmd & 0x02)) {
+				p->payload_size = p->rsp.payload_len * sizeof(uint16_t);
+				if (p->payload_size > p->payload_max) {
+					p->state = AMC_PARSER_SKIP;
+					p->count = p->payload_size + sizeof(uint16_t);
+					p->dropped++;
+					*consumed = used;
+					return AMC_EBUFSIZE;
+				}
+				p->state = AMC_PARSER_PAYLOAD;
+				break;
+			}
+			p->frames++;
+			*consumed = used;
+			return 1;
+
+		case AMC_PARSER_PAYLOAD:
+			if (p->count < p->payload_size) {
+				n = p->payload_size - p->count;
+				if (n > len - used) n = len - used;
+				memcpy((uint8_t *)p->payload + p->count, in + used, n);
+			}
+			else {
+				n = p->payload_size + sizeof(uint16_t) - p->count;
+				if (n > len - used) n = len - used;
+				memcpy((uint8_t *)&p->payload_crc + (p->count - p->payload_size), in + used, n);
+			}
+			p->count += n;
+			used += n;
+			if (p->count < p->payload_size + sizeof(uint16_t)) {
+				break;
+			}
+
+			p->state = AMC_PARSER_HEADER;
+			p->count = 0;
+			*consumed = used;
+			if (amc_crc_update(0, p->payload, p->payload_size) != ntohs(p->payload_crc)) {
+				p->crc_errors++;
+				return AMC_ECRC;
+			}
+			p->frames++;
+			return 1;
+
+		case AMC_PARSER_SKIP:
+			n = (p->count < len - used) ? p->count : len - used;
+			p->count -= n;
+			p->discarded += n;
+			used += n;
+			if (p->count == 0) {
+				p->state = AMC_PARSER_HEADER;
+			}
+			break;
+		}
+	}
+
+	*consumed = used;
+	return 0;
+}
@@ -4,19 +4,48 @@
 \author Jim George
 */
 
+#define _GNU_SOURCE /* for ppoll */
 #include <unistd.h>
 #include <stdio.h>
+#include <string.h>
 #include <strings.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <fcntl.h>
 #include <termios.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
 #include <linux/serial.h>
 #include <errno.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include "amc.h"
 #include "serial.h"
 
-#define SERIAL_PORT_SPD_TBL_MAX 18
+/* termios2 lets the kernel program any integer baud rate (BOTHER) and
+report back the rate the UART achieved. <asm/termbits.h> clashes with
+<termios.h>, so the structure is repeated here for the architectures
+that share the generic layout; the rest fall back to the speed table. */
+#if defined(__linux__) && !defined(__powerpc__) && !defined(__alpha__) && \
+	!defined(__sparc__) && !defined(__mips__)
+#define SERIAL_HAVE_TERMIOS2
+struct serial_termios2 {
+	tcflag_t c_iflag;
+	tcflag_t c_oflag;
+	tcflag_t c_cflag;
+	tcflag_t c_lflag;
+	cc_t c_line;
+	cc_t c_cc[19];
+	speed_t c_ispeed;
+	speed_t c_ospeed;
+};
+#define SERIAL_TCGETS2 _IOR('T', 0x2A, struct serial_termios2)
+#define SERIAL_TCSETS2 _IOW('T', 0x2B, struct serial_termios2)
+#define SERIAL_BOTHER 0010000
+#endif
+
+#define SERIAL_PORT_SPD_TBL_MAX 26
 static struct {
 	int baud;
 	speed_t ident;
@@ -38,7 +67,15 @@ static struct {
 {38400, B38400},
 {57600, B57600},
 {115200, B115200},
-{230400, B230400}
+{230400, B230400},
+{460800, B460800},
+{500000, B500000},
+{576000, B576000},
+{921600, B921600},
+{1000000, B1000000},
+{1152000, B1152000},
+{1500000, B1500000},
+{2000000, B2000000}
 };
 
 /**
@@ -63,6 +100,91 @@ static speed_t serial_port_get_speed(const unsigned int speed)
 	return -1;
 }
 
+/**
+\brief Get the output baud rate a serial port is set to
+\param fd File descriptor of the serial port
+\return Baud rate, or 0 if fd is not a serial port or the rate cannot
+be determined
+
+Where termios2 is available this is the rate the driver reports it has
+programmed, which can differ slightly from the rate asked for. Otherwise
+only rates in the speed table are recognized.
+*/
+unsigned int serial_port_get_baud(int fd)
+{
+	struct termios term_st;
+	speed_t ident;
+	int ctr;
+
+#ifdef SERIAL_HAVE_TERMIOS2
+	{
+		struct serial_termios2 term2_st;
+		if (0 == ioctl(fd, SERIAL_TCGETS2, &term2_st) && term2_st.c_ospeed != 0) {
+			return term2_st.c_ospeed;
+		}
+	}
+#endif
+	if (tcgetattr(fd, &term_st)) {
+		return 0;
+	}
+	ident = cfgetospeed(&term_st);
+	for (ctr = 0; ctr < SERIAL_PORT_SPD_TBL_MAX; ctr++) {
+		if (ident == serial_port_speed_table[ctr].ident) {
+			return serial_port_speed_table[ctr].baud;
+		}
+	}
+	return 0;
+}
+
+/**
+\brief Set the baud rate of a serial port
+\param fd File descriptor of the serial port
+\param speed Baud rate to set, any nonzero integer rate
+\return Baud rate achieved by the port, or 0 on error
+
+With termios2 the rate is set with BOTHER, so non-standard rates work as
+long as the UART can generate them, and the achieved rate is read back
+from the driver. Without it, speed must be one of the rates in the speed
+table. Input and output run at the same rate.
+*/
+unsigned int serial_port_set_baud(int fd, unsigned int speed)
+{
+	struct termios term_st;
+	speed_t spd_macro;
+
+	if (speed == 0) {
+		return 0;
+	}
+#ifdef SERIAL_HAVE_TERMIOS2
+	{
+		struct serial_termios2 term2_st;
+		if (0 == ioctl(fd, SERIAL_TCGETS2, &term2_st)) {
+			/* Clearing CIBAUD makes the input rate follow the output rate */
+			term2_st.c_cflag &= ~(CBAUD | CIBAUD);
+			term2_st.c_cflag |= SERIAL_BOTHER;
+			term2_st.c_ispeed = speed;
+			term2_st.c_ospeed = speed;
+			if (ioctl(fd, SERIAL_TCSETS2, &term2_st)) {
+				perror("TCSETS2");
+				return 0;
+			}
+			return serial_port_get_baud(fd);
+		}
+	}
+#endif
+	spd_macro = serial_port_get_speed(speed);
+	if (spd_macro == -1 || tcgetattr(fd, &term_st)) {
+		return 0;
+	}
+	cfsetispeed(&term_st, spd_macro);
+	cfsetospeed(&term_st, spd_macro);
+	if (tcsetattr(fd, TCSANOW, &term_st)) {
+		perror("tcsetattr");
+		return 0;
+	}
+	return serial_port_get_baud(fd);
+}
+
 /**
 \brief Initialize serial port
 \param *device_name Unix device name for the serial port to open
@@ -70,7 +192,8 @@ static speed_t serial_port_get_speed(const unsigned int speed)
 \param *port Pointer to the file descriptor for the serial port
 \return 0 on success, -1 on error
 
-The port is opened with 8N1 settings (8-bit, no parity, 1 stop bit)
+The port is opened with 8N1 settings (8-bit, no parity, 1 stop bit). The
+speed is set with serial_port_set_baud, see there for the rates accepted.
 */
 int serial_port_init(const char *device_name,
 	unsigned int speed,
@@ -93,13 +216,6 @@ int serial_port_init(const char *device_name,
 		return -1;
 	}
 
-	/* Set interface speed */
-	{
-		int spd_macro = serial_port_get_speed(speed);
-		if (spd_macro == -1) return -1;
-		cfsetispeed(&term_st, spd_macro);
-		cfsetospeed(&term_st, spd_macro);
-	}
 	/* Enable raw mode output */
 	cfmakeraw(&term_st);
 	term_st.c_oflag &= ~OPOST;
@@ -117,7 +233,8 @@ int serial_port_init(const char *device_name,
 	term_st.c_cflag &= ~CRTSCTS;
 	term_st.c_iflag &= ~(IXON | IXOFF | IXANY);
 	
-	/* Min. 1 character for read to unblock */
+	/* Min. 1 character for read to unblock, see serial_port_tune for
+	the polled alternative */
 	term_st.c_cc[VMIN] = 1;
 	/* Set timeout to 1 second */
 	term_st.c_cc[VTIME] = 10;
@@ -130,6 +247,13 @@ int serial_port_init(const char *device_name,
 		perror("tcgetattr");
 		return -1;
 	}
+
+	/* Set interface speed */
+	if (0 == serial_port_set_baud(*port, speed)) {
+		close(*port);
+		*port = -1;
+		return -1;
+	}
 	
 	return 0;
 }
@@ -139,3 +263,201 @@ void serial_port_flush(int fd)
 	tcflush(fd, TCIOFLUSH);
 }
 
+
+/**
+\brief Lower the latency timer of a USB-serial adapter
+\param *device_name Device name the port was opened with
+\param latency_ms Latency timer to set, in milliseconds
+\return 0 if the timer is at or below latency_ms, -1 otherwise
+
+USB-serial chips such as the FTDI parts hold received bytes for up to the
+latency timer (16 ms by default) before passing them to the host, which
+dominates the turnaround of a short transaction. Drivers that support
+changing it expose a latency_timer attribute on the port's device in sysfs;
+ports without it are left alone.
+*/
+static int serial_port_set_latency_timer(const char *device_name, int latency_ms)
+{
+	char path[PATH_MAX], *real, *name;
+	FILE *attr;
+	int current = -1;
+
+	real = realpath(device_name, NULL);
+	if (real == NULL) {
+		return -1;
+	}
+	name = strrchr(real, '/');
+	snprintf(path, sizeof(path), "/sys/class/tty/%s/device/latency_timer",
+		(name != NULL) ? name + 1 : real);
+	free(real);
+
+	attr = fopen(path, "r+");
+	if (attr == NULL) {
+		return -1;
+	}
+	if (1 == fscanf(attr, "%d", &current) && current > latency_ms) {
+		rewind(attr);
+		fprintf(attr, "%d\n", latency_ms);
+		fflush(attr);
+		rewind(attr);
+		if (1 != fscanf(attr, "%d", &current)) {
+			current = -1;
+		}
+	}
+	fclose(attr);
+	return (current >= 0 && current <= latency_ms) ? 0 : -1;
+}
+
+/**
+\brief Tune a serial port for low latency
+\param fd File descriptor of the serial port
+\param *device_name Device name the port was opened with
+\param flags Settings to apply, a combination of AMC_SERIAL_* flags
+\return The subset of flags that took effect
+
+Each setting is tried independently, ports that do not support one
+simply do not report it as applied. AMC_SERIAL_POLLED_READ sets VMIN and
+VTIME to zero so that a read never blocks: the library always waits for
+readiness under the transaction deadline before reading, and a read
+that could block would escape that deadline.
+*/
+int serial_port_tune(int fd, const char *device_name, int flags)
+{
+	int applied = 0;
+
+	if (flags & AMC_SERIAL_ASYNC_LOW_LATENCY) {
+		struct serial_struct serinfo;
+		if (0 == ioctl(fd, TIOCGSERIAL, &serinfo)) {
+			serinfo.flags |= ASYNC_LOW_LATENCY;
+			if (0 == ioctl(fd, TIOCSSERIAL, &serinfo) &&
+				0 == ioctl(fd, TIOCGSERIAL, &serinfo) &&
+				(serinfo.flags & ASYNC_LOW_LATENCY)) {
+				applied |= AMC_SERIAL_ASYNC_LOW_LATENCY;
+			}
+		}
+	}
+	if (flags & AMC_SERIAL_USB_LATENCY_TIMER) {
+		if (0 == serial_port_set_latency_timer(device_name, AMC_SERIAL_USB_LATENCY_MS)) {
+			applied |= AMC_SERIAL_USB_LATENCY_TIMER;
+		}
+	}
+	if (flags & AMC_SERIAL_POLLED_READ) {
+		struct termios term_st;
+		if (0 == tcgetattr(fd, &term_st)) {
+			term_st.c_cc[VMIN] = 0;
+			term_st.c_cc[VTIME] = 0;
+			if (0 == tcsetattr(fd, TCSANOW, &term_st)) {
+				applied |= AMC_SERIAL_POLLED_READ;
+			}
+		}
+	}
+	return applied;
+}
+
+/**
+\brief Assert the RTS line of a serial port
+\param fd File descriptor of the serial port
+*/
+void serial_port_set_rts(int fd)
+{
+	int bits = TIOCM_RTS;
+	ioctl(fd, TIOCMBIS, &bits);
+}
+
+/**
+\brief Deassert the RTS line of a serial port
+\param fd File descriptor of the serial port
+*/
+void serial_port_clear_rts(int fd)
+{
+	int bits = TIOCM_RTS;
+	ioctl(fd, TIOCMBIC, &bits);
+}
+
+/**
+\brief Configure kernel RS-485 mode on a serial port
+\param fd File descriptor of the serial port
+\param *rs485 Settings to apply, updated with the settings the driver accepted
+\return 0 on success, -1 if the port has no RS-485 support
+
+Drivers adjust settings they cannot honour (delays are clamped, for
+example), the kernel hands the result back in *rs485.
+*/
+int serial_port_set_rs485(int fd, struct serial_rs485 *rs485)
+{
+	return ioctl(fd, TIOCSRS485, rs485) ? -1 : 0;
+}
+
+/**
+\brief Read the RS-485 mode of a serial port
+\param fd File descriptor of the serial port
+\param *rs485 Set to the current settings
+\return 0 on success, -1 if the port has no RS-485 support
+*/
+int serial_port_get_rs485(int fd, struct serial_rs485 *rs485)
+{
+	return ioctl(fd, TIOCGRS485, rs485) ? -1 : 0;
+}
+
+static ssize_t serial_port_writev(struct amc_transport *xprt,
+	const struct iovec *iov, int iovcnt)
+{
+	return writev(xprt->fd, iov, iovcnt);
+}
+
+static ssize_t serial_port_readv(struct amc_transport *xprt,
+	const struct iovec *iov, int iovcnt)
+{
+	return readv(xprt->fd, iov, iovcnt);
+}
+
+static int serial_port_wait(struct amc_transport *xprt,
+	const struct timespec *timeout)
+{
+	struct pollfd pfd;
+	int ret;
+
+	pfd.fd = xprt->fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	ret = ppoll(&pfd, 1, timeout, NULL);
+	return (ret > 0) ? 1 : ret;
+}
+
+static void serial_port_xprt_flush(struct amc_transport *xprt)
+{
+	serial_port_flush(xprt->fd);
+}
+
+static void serial_port_close(struct amc_transport *xprt)
+{
+	if (xprt->fd >= 0) {
+		close(xprt->fd);
+		xprt->fd = -1;
+	}
+}
+
+static const struct amc_transport_ops serial_port_ops = {
+	.writev = serial_port_writev,
+	.readv = serial_port_readv,
+	.wait = serial_port_wait,
+	.flush = serial_port_xprt_flush,
+	.close = serial_port_close
+};
+
+/**
+\brief Set up a transport for an open serial port
+\param *xprt Transport to initialize
+\param fd File descriptor of the serial port
+
+The transport calls writev, readv and ppoll on fd directly, and flushes
+with tcflush. Closing the transport closes fd.
+*/
+void serial_port_transport(struct amc_transport *xprt, int fd)
+{
+	assert(xprt != NULL);
+	xprt->ops = &serial_port_ops;
+	xprt->fd = fd;
+	xprt->priv = NULL;
+	xprt->deadline = NULL;
+}
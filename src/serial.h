@@ -6,12 +6,21 @@
 
 #ifndef _SERIAL_H_
 
+struct amc_transport;
+struct serial_rs485;
+
 int serial_port_init(const char *device_name,
 	unsigned int speed,
 	int *port);
 void serial_port_flush(int fd);
+unsigned int serial_port_get_baud(int fd);
+unsigned int serial_port_set_baud(int fd, unsigned int speed);
+int serial_port_tune(int fd, const char *device_name, int flags);
 void serial_port_set_rts(int fd);
 void serial_port_clear_rts(int fd);
+int serial_port_set_rs485(int fd, struct serial_rs485 *rs485);
+int serial_port_get_rs485(int fd, struct serial_rs485 *rs485);
+void serial_port_transport(struct amc_transport *xprt, int fd);
 
 #define _SERIAL_H_
 
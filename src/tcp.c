@@ -0,0 +1,286 @@
+/**
+\file src/tcp.c
+\brief TCP transport for drives behind serial device servers
+\author Jim George
+
+Talks to a serial device server (a terminal server in raw TCP mode) over
+a plain socket instead of a virtual tty driver. Nagle's algorithm is
+turned off, and every frame is handed to the kernel with a single
+sendmsg, so a header and its payload leave in the same segment rather
+than being held back or split by the send path.
+
+The line settings of the far end (baud rate, RS-485 mode) are configured
+on the device server itself. A drive created on this transport does not
+know the baud rate, set drv->bus->baud to keep the wire time model and the
+adaptive timeouts accurate.
+*/
+
+#define _GNU_SOURCE /* for ppoll */
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <assert.h>
+#include <poll.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "amc.h"
+
+/**
+\brief Work out the time left until a deadline
+\param *deadline CLOCK_MONOTONIC deadline
+\param *left Location to store the time left
+\return 0 if there is time left, -1 if the deadline has passed
+*/
+static int amc_tcp_time_left(const struct timespec *deadline, struct timespec *left)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	left->tv_sec = deadline->tv_sec - now.tv_sec;
+	left->tv_nsec = deadline->tv_nsec - now.tv_nsec;
+	if (left->tv_nsec < 0) {
+		left->tv_sec--;
+		left->tv_nsec += 1000000000L;
+	}
+	return (left->tv_sec < 0) ? -1 : 0;
+}
+
+/**
+\brief Wait until a socket can take more data
+\param fd Socket
+\param *deadline CLOCK_MONOTONIC deadline, NULL to wait for as long as it takes
+\return 0 when writable, -1 with errno set on failure, ETIMEDOUT once the
+deadline has passed
+*/
+static int amc_tcp_wait_writable(int fd, const struct timespec *deadline)
+{
+	struct pollfd pfd;
+	struct timespec left;
+	int ret;
+
+	pfd.fd = fd;
+	pfd.events = POLLOUT;
+	do {
+		if (deadline != NULL && amc_tcp_time_left(deadline, &left)) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		pfd.revents = 0;
+		ret = ppoll(&pfd, 1, (deadline != NULL) ? &left : NULL, NULL);
+	} while (ret == -1 && errno == EINTR);
+	if (ret == 0) {
+		errno = ETIMEDOUT;
+		return -1;
+	}
+	return (ret < 0) ? -1 : 0;
+}
+
+/**
+\brief Send a frame without blocking past the deadline of its transaction
+
+A device server that stops reading fills the send buffer, after which a
+blocking send would wait for as long as the peer takes. Sends are made
+with MSG_DONTWAIT instead, waiting for room under xprt->deadline in
+between. Whatever is left of an iovec that went out in part is sent on
+its own before carrying on with the rest.
+*/
+static ssize_t amc_tcp_writev(struct amc_transport *xprt, const struct iovec *iov, int iovcnt)
+{
+	struct msghdr msg;
+	ssize_t total = 0, ret;
+	size_t done = 0;
+
+	while (iovcnt > 0) {
+		if (done > 0) {
+			/* A dropped connection is reported as an error, not SIGPIPE */
+			ret = send(xprt->fd, (const uint8_t *)iov->iov_base + done,
+				iov->iov_len - done, MSG_NOSIGNAL | MSG_DONTWAIT);
+		}
+		else {
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_iov = (struct iovec *)iov;
+			msg.msg_iovlen = iovcnt;
+			ret = sendmsg(xprt->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+		}
+		if (ret == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if ((errno != EAGAIN && errno != EWOULDBLOCK) ||
+				amc_tcp_wait_writable(xprt->fd, xprt->deadline)) {
+				return -1;
+			}
+			continue;
+		}
+		total += ret;
+
+		/* Step over the iovecs that were sent */
+		ret += done;
+		done = 0;
+		while (iovcnt > 0 && ret >= iov->iov_len) {
+			ret -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		done = ret;
+	}
+	return total;
+}
+
+static ssize_t amc_tcp_readv(struct amc_transport *xprt, const struct iovec *iov, int iovcnt)
+{
+	return readv(xprt->fd, iov, iovcnt);
+}
+
+static int amc_tcp_wait(struct amc_transport *xprt, const struct timespec *timeout)
+{
+	struct pollfd pfd;
+	int ret;
+
+	pfd.fd = xprt->fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	ret = ppoll(&pfd, 1, timeout, NULL);
+	return (ret > 0) ? 1 : ret;
+}
+
+/**
+\brief Throw away whatever has been received and not read yet
+
+There is no equivalent of tcflush for a socket; data already on its way
+from the device server cannot be recalled, amc_recover waits for the line
+to go quiet before flushing for that reason.
+*/
+static void amc_tcp_flush(struct amc_transport *xprt)
+{
+	uint8_t buffer[256];
+
+	while (recv(xprt->fd, buffer, sizeof(buffer), MSG_DONTWAIT) > 0);
+}
+
+static void amc_tcp_close(struct amc_transport *xprt)
+{
+	if (xprt->fd >= 0) {
+		close(xprt->fd);
+		xprt->fd = -1;
+	}
+}
+
+static const struct amc_transport_ops amc_tcp_ops = {
+	.writev = amc_tcp_writev,
+	.readv = amc_tcp_readv,
+	.wait = amc_tcp_wait,
+	.flush = amc_tcp_flush,
+	.close = amc_tcp_close
+};
+
+/**
+\brief Connect a socket without blocking for longer than a deadline
+\param fd Socket, not connected
+\param *addr Address to connect to
+\param addrlen Length of *addr
+\param *deadline CLOCK_MONOTONIC time by which the connection must be up
+\return 0 on success, -1 with errno set on failure
+*/
+static int amc_tcp_connect(int fd, const struct sockaddr *addr, socklen_t addrlen,
+	const struct timespec *deadline)
+{
+	int flags = fcntl(fd, F_GETFL);
+	int ret, err = 0;
+	socklen_t errlen = sizeof(err);
+
+	if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK)) {
+		return -1;
+	}
+	ret = connect(fd, addr, addrlen);
+	if (ret == -1 && errno == EINPROGRESS) {
+		if (amc_tcp_wait_writable(fd, deadline) ||
+			getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errlen)) {
+			return -1;
+		}
+		if (err != 0) {
+			errno = err;
+			return -1;
+		}
+	}
+	else if (ret == -1) {
+		return -1;
+	}
+	/* The protocol code expects blocking reads and writes */
+	return fcntl(fd, F_SETFL, flags);
+}
+
+/**
+\brief Connect a transport to a serial device server
+\param *xprt Transport to initialize
+\param *host Host name or address of the device server
+\param *port TCP port or service name of the serial port on the server
+\param timeout_ms Time allowed for the connection, across all addresses
+the host name resolves to, in milliseconds
+\return 0 on success, -1 on failure with errno set (ETIMEDOUT if the
+server did not answer in time, EHOSTUNREACH if host or port could not be
+resolved)
+
+The socket has TCP_NODELAY set, so each command is sent as soon as it
+is written, in one segment. Close the transport with amc_transport_close.
+*/
+int amc_tcp_open(struct amc_transport *xprt, const char *host, const char *port, int timeout_ms)
+{
+	struct addrinfo hints, *res, *ai;
+	struct timespec deadline;
+	int fd = -1, one = 1, ret, err = ETIMEDOUT;
+
+	assert(xprt != NULL);
+	assert(host != NULL && port != NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	ret = getaddrinfo(host, port, &hints, &res);
+	if (ret != 0) {
+		errno = (ret == EAI_SYSTEM) ? errno : EHOSTUNREACH;
+		return -1;
+	}
+	for (ai = res; ai != NULL; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+		if (fd == -1) {
+			err = errno;
+			continue;
+		}
+		if (0 == amc_tcp_connect(fd, ai->ai_addr, ai->ai_addrlen, &deadline)) {
+			break;
+		}
+		err = errno;
+		close(fd);
+		fd = -1;
+		if (err == ETIMEDOUT) {
+			break;
+		}
+	}
+	freeaddrinfo(res);
+	if (fd == -1) {
+		errno = err;
+		return -1;
+	}
+
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	xprt->ops = &amc_tcp_ops;
+	xprt->fd = fd;
+	xprt->priv = NULL;
+	xprt->deadline = NULL;
+	return 0;
+}
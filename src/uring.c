@@ -0,0 +1,767 @@
+/**
+\file src/uring.c
+\brief io_uring transport for many serial ports
+\author Jim George
+
+Every port opened on a struct amc_uring shares one submission and one
+completion ring. Writes are copied into a per-port fixed buffer and
+queued, not submitted; the next wait on any port submits everything
+queued on all ports with a single io_uring_enter, along with a read for
+the port waited on. Completions for other ports are stored with those
+ports, so when the host is busy the response a wait is looking for has
+often arrived already and is picked up from the completion ring without
+entering the kernel at all.
+
+Port file descriptors are registered with the ring, and the receive and
+transmit buffers of all ports live in one registered buffer. Reads are
+linked behind a poll for input, so that a port in polled read mode
+(VMIN=0) does not complete empty reads in a loop. The ring is driven
+with raw system calls against <linux/io_uring.h>, so liburing is not
+needed.
+
+Where the kernel has no io_uring (or it is disabled, or too old to time
+out a wait), amc_uring_new fails with ENOSYS and amc_uring_transport
+falls back to the tty transport, so callers can use the same code on
+every host. The backend is left out altogether with
+./configure --disable-io-uring.
+
+A queued write only reaches the port once some wait or read is done on
+the ring. Callers that send without reading back a response (broadcasts)
+push it out with amc_uring_submit.
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+#include <time.h>
+#include <config.h>
+
+#include "amc.h"
+#include "serial.h"
+
+#ifdef AMC_HAVE_IO_URING
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/* Per-port buffer sizes, the transmit buffer holds a few maximum size
+frames; larger batches are written directly */
+#define AMC_URING_RX_SIZE AMC_RXBUF_SIZE
+#define AMC_URING_TX_SIZE 2048
+#define AMC_URING_PORT_SIZE (AMC_URING_RX_SIZE + AMC_URING_TX_SIZE)
+
+/* Kinds of request, in the low byte of user_data */
+#define AMC_URING_POLL 1
+#define AMC_URING_READ 2
+#define AMC_URING_WRITE 3
+#define AMC_URING_CANCEL 4
+
+struct amc_uring_port {
+	struct amc_uring *ring; /**< Ring the port belongs to */
+	int index; /**< Slot in the ring, also the registered file index */
+	int fd; /**< File descriptor of the port */
+	int in_use; /**< Nonzero while the slot is taken */
+	int fixed_file; /**< Nonzero if fd is registered with the ring */
+	int read_armed; /**< A poll and read are queued or in flight */
+	int write_busy; /**< A write is queued or in flight */
+	int tx_len; /**< Length of the write in flight */
+	int err; /**< errno of a failed request, reported on the next call */
+	int eof; /**< The port reported end of file */
+	int rx_head; /**< Offset of the first unread byte in rx */
+	int rx_len; /**< Offset one past the last unread byte in rx */
+	uint8_t *rx; /**< Receive buffer, part of the registered buffer */
+	uint8_t *tx; /**< Transmit buffer, part of the registered buffer */
+};
+
+struct amc_uring {
+	int ring_fd; /**< io_uring file descriptor */
+	int max_ports; /**< Number of port slots */
+	int fixed_bufs; /**< Nonzero if the buffers are registered */
+	int poll_cqe; /**< Nonzero if a poll that succeeds still posts a completion */
+	unsigned int sq_entries; /**< Size of the submission ring */
+	unsigned int sq_tail; /**< Next submission slot */
+	unsigned int to_submit; /**< Entries queued but not yet submitted */
+	unsigned int *sq_head, *sq_ktail, *sq_mask, *sq_array;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring, *cq_ring; /**< Ring mappings */
+	size_t sq_ring_size, cq_ring_size, sqes_size;
+	uint8_t *buffers; /**< Port buffers, one mapping */
+	size_t buffers_size;
+	struct amc_uring_port *ports; /**< Port slots */
+	struct amc_uring_stats stats; /**< System call and request counts */
+};
+
+static int amc_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int amc_uring_register(int fd, unsigned int opcode, const void *arg, unsigned int nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/**
+\brief Submit queued requests and optionally wait for completions
+\param *u Ring
+\param wait Number of completions to wait for, 0 to only submit
+\param *timeout Longest wait, NULL for no limit
+\return Number of requests submitted, or -1 with errno set
+*/
+static int amc_uring_enter(struct amc_uring *u, int wait, const struct timespec *timeout)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned int flags = 0;
+	int ret;
+
+	if (wait) {
+		flags |= IORING_ENTER_GETEVENTS;
+	}
+	memset(&arg, 0, sizeof(arg));
+	if (wait && timeout != NULL) {
+		ts.tv_sec = timeout->tv_sec;
+		ts.tv_nsec = timeout->tv_nsec;
+		arg.sigmask_sz = _NSIG / 8;
+		arg.ts = (uint64_t)(uintptr_t)&ts;
+		flags |= IORING_ENTER_EXT_ARG;
+	}
+	__atomic_store_n(u->sq_ktail, u->sq_tail, __ATOMIC_RELEASE);
+	ret = syscall(__NR_io_uring_enter, u->ring_fd, u->to_submit, wait, flags,
+		(flags & IORING_ENTER_EXT_ARG) ? &arg : NULL,
+		(flags & IORING_ENTER_EXT_ARG) ? sizeof(arg) : 0);
+	u->stats.enters++;
+	if (ret > 0) {
+		u->to_submit -= ret;
+		u->stats.submitted += ret;
+	}
+	return ret;
+}
+
+/**
+\brief Make sure a number of submission slots are free
+\param *u Ring
+\param count Slots needed, linked requests must not be split by a submit
+*/
+static void amc_uring_reserve(struct amc_uring *u, unsigned int count)
+{
+	while (u->sq_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) + count > u->sq_entries) {
+		if (amc_uring_enter(u, 0, NULL) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+			return;
+		}
+	}
+}
+
+static struct io_uring_sqe *amc_uring_sqe(struct amc_uring *u, struct amc_uring_port *port,
+	int opcode, int kind)
+{
+	unsigned int idx = u->sq_tail & *u->sq_mask;
+	struct io_uring_sqe *sqe = &u->sqes[idx];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	if (port->fixed_file) {
+		sqe->fd = port->index;
+		sqe->flags = IOSQE_FIXED_FILE;
+	}
+	else {
+		sqe->fd = port->fd;
+	}
+	sqe->user_data = ((uint64_t)port->index << 8) | kind;
+	u->sq_array[idx] = idx;
+	u->sq_tail++;
+	u->to_submit++;
+	return sqe;
+}
+
+/**
+\brief Queue a read into an empty receive buffer, behind a poll for input
+*/
+static void amc_uring_arm_read(struct amc_uring_port *port)
+{
+	struct amc_uring *u = port->ring;
+	struct io_uring_sqe *sqe;
+
+	amc_uring_reserve(u, 2);
+	sqe = amc_uring_sqe(u, port, IORING_OP_POLL_ADD, AMC_URING_POLL);
+	sqe->poll32_events = POLLIN;
+	sqe->flags |= IOSQE_IO_LINK;
+#ifdef IORING_FEAT_CQE_SKIP
+	if (!u->poll_cqe) {
+		sqe->flags |= IOSQE_CQE_SKIP_SUCCESS;
+	}
+#endif
+
+	sqe = amc_uring_sqe(u, port, u->fixed_bufs ? IORING_OP_READ_FIXED : IORING_OP_READ,
+		AMC_URING_READ);
+	sqe->addr = (uint64_t)(uintptr_t)port->rx;
+	sqe->len = AMC_URING_RX_SIZE;
+	sqe->off = (uint64_t)-1;
+	port->rx_head = port->rx_len = 0;
+	port->read_armed = 1;
+}
+
+/**
+\brief Take all completions off the ring and store them with their ports
+*/
+static void amc_uring_reap(struct amc_uring *u)
+{
+	unsigned int head = *u->cq_head;
+	unsigned int tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+
+	while (head != tail) {
+		struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+		unsigned int index = cqe->user_data >> 8;
+		struct amc_uring_port *port = (index < u->max_ports) ? &u->ports[index] : NULL;
+
+		u->stats.completed++;
+		if (port != NULL && port->in_use) {
+			switch (cqe->user_data & 0xFF) {
+			case AMC_URING_READ:
+				port->read_armed = 0;
+				if (cqe->res > 0) {
+					port->rx_len = cqe->res;
+				}
+				else if (cqe->res == 0) {
+					port->eof = 1;
+				}
+				else if (cqe->res != -ECANCELED) {
+					port->err = -cqe->res;
+				}
+				break;
+			case AMC_URING_WRITE:
+				port->write_busy = 0;
+				if (cqe->res == -ECANCELED) {
+					/* Cancelled at its deadline, the transaction already failed */
+				}
+				else if (cqe->res < 0) {
+					port->err = -cqe->res;
+				}
+				else if (cqe->res != port->tx_len) {
+					port->err = EIO;
+				}
+				break;
+			case AMC_URING_POLL:
+				/* A failed poll cancels the read linked to it */
+			case AMC_URING_CANCEL:
+				break;
+			}
+		}
+		head++;
+	}
+	__atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/**
+\brief Wait until a port has received data, or the timeout expires
+\param *port Port to wait on
+\param *timeout Longest wait, NULL for no limit
+\return 1 if data (or end of file) is waiting, 0 on timeout, -1 on error
+*/
+static int amc_uring_wait_port(struct amc_uring_port *port, const struct timespec *timeout)
+{
+	struct amc_uring *u = port->ring;
+	struct timespec end, now, left;
+	int wait_nr;
+
+	if (timeout != NULL) {
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		end.tv_sec += timeout->tv_sec;
+		end.tv_nsec += timeout->tv_nsec;
+		if (end.tv_nsec >= 1000000000L) {
+			end.tv_sec++;
+			end.tv_nsec -= 1000000000L;
+		}
+	}
+
+	for (;;) {
+		amc_uring_reap(u);
+		if (port->err) {
+			errno = port->err;
+			port->err = 0;
+			return -1;
+		}
+		if (port->rx_head < port->rx_len || port->eof) {
+			return 1;
+		}
+		if (!port->read_armed) {
+			amc_uring_arm_read(port);
+		}
+		if (timeout != NULL) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			left.tv_sec = end.tv_sec - now.tv_sec;
+			left.tv_nsec = end.tv_nsec - now.tv_nsec;
+			if (left.tv_nsec < 0) {
+				left.tv_sec--;
+				left.tv_nsec += 1000000000L;
+			}
+			if (left.tv_sec < 0) {
+				/* Out of time, but still hand over what was queued */
+				if (u->to_submit > 0) {
+					amc_uring_enter(u, 0, NULL);
+				}
+				return 0;
+			}
+		}
+		/* Wake up once the read is done rather than on the completions that
+		come before it, which also saves a system call per transaction */
+		wait_nr = (port->read_armed ? 1 + u->poll_cqe : 0) + (port->write_busy ? 1 : 0);
+		if (amc_uring_enter(u, wait_nr ? wait_nr : 1, (timeout != NULL) ? &left : NULL) < 0 &&
+			errno != ETIME && errno != EAGAIN && errno != EBUSY) {
+			return -1;
+		}
+	}
+}
+
+/**
+\brief Ask for a request of a port to be cancelled
+\param *port Port
+\param kind AMC_URING_POLL, AMC_URING_READ or AMC_URING_WRITE
+
+The cancellation is submitted with the next enter, the request completes
+(with -ECANCELED if it was still running) some time after.
+*/
+static void amc_uring_cancel(struct amc_uring_port *port, int kind)
+{
+	struct amc_uring *u = port->ring;
+	struct io_uring_sqe *sqe;
+
+	amc_uring_reserve(u, 1);
+	sqe = amc_uring_sqe(u, port, IORING_OP_ASYNC_CANCEL, AMC_URING_CANCEL);
+	sqe->fd = -1;
+	sqe->flags = 0;
+	sqe->addr = ((uint64_t)port->index << 8) | kind;
+}
+
+static ssize_t amc_uring_writev(struct amc_transport *xprt, const struct iovec *iov, int iovcnt)
+{
+	struct amc_uring_port *port = xprt->priv;
+	struct amc_uring *u = port->ring;
+	struct io_uring_sqe *sqe;
+	int part, total = 0;
+
+	/* Writes to a port go out in order, one at a time. An earlier write
+	that is stuck (flow control, a pulled adapter) is waited for until the
+	transaction deadline, then cancelled */
+	for (amc_uring_reap(u); port->write_busy; amc_uring_reap(u)) {
+		struct timespec now, left;
+
+		if (xprt->deadline != NULL) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			left.tv_sec = xprt->deadline->tv_sec - now.tv_sec;
+			left.tv_nsec = xprt->deadline->tv_nsec - now.tv_nsec;
+			if (left.tv_nsec < 0) {
+				left.tv_sec--;
+				left.tv_nsec += 1000000000L;
+			}
+			if (left.tv_sec < 0) {
+				amc_uring_cancel(port, AMC_URING_WRITE);
+				amc_uring_enter(u, 0, NULL);
+				errno = ETIMEDOUT;
+				return -1;
+			}
+		}
+		if (amc_uring_enter(u, 1, (xprt->deadline != NULL) ? &left : NULL) < 0 &&
+			errno != EINTR && errno != ETIME && errno != EAGAIN && errno != EBUSY) {
+			return -1;
+		}
+	}
+	if (port->err) {
+		errno = port->err;
+		port->err = 0;
+		return -1;
+	}
+
+	for (part = 0; part < iovcnt; part++) {
+		total += iov[part].iov_len;
+	}
+	if (total > AMC_URING_TX_SIZE) {
+		return writev(port->fd, iov, iovcnt);
+	}
+	for (part = 0, total = 0; part < iovcnt; part++) {
+		memcpy(port->tx + total, iov[part].iov_base, iov[part].iov_len);
+		total += iov[part].iov_len;
+	}
+
+	amc_uring_reserve(u, 1);
+	sqe = amc_uring_sqe(u, port, u->fixed_bufs ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE,
+		AMC_URING_WRITE);
+	sqe->addr = (uint64_t)(uintptr_t)port->tx;
+	sqe->len = total;
+	sqe->off = (uint64_t)-1;
+	port->tx_len = total;
+	port->write_busy = 1;
+
+	/* Queue the read for the response now, so that one enter for any port
+	sends every command and collects every response that is ready */
+	if (!port->read_armed && port->rx_head == port->rx_len && !port->eof) {
+		amc_uring_arm_read(port);
+	}
+	return total;
+}
+
+static ssize_t amc_uring_readv(struct amc_transport *xprt, const struct iovec *iov, int iovcnt)
+{
+	struct amc_uring_port *port = xprt->priv;
+	int part, copied = 0;
+
+	if (port->rx_head == port->rx_len && !port->eof) {
+		if (amc_uring_wait_port(port, NULL) < 0) {
+			return -1;
+		}
+	}
+	for (part = 0; part < iovcnt && port->rx_head < port->rx_len; part++) {
+		int len = port->rx_len - port->rx_head;
+		if (len > iov[part].iov_len) {
+			len = iov[part].iov_len;
+		}
+		memcpy(iov[part].iov_base, port->rx + port->rx_head, len);
+		port->rx_head += len;
+		copied += len;
+	}
+	return copied;
+}
+
+static int amc_uring_wait(struct amc_transport *xprt, const struct timespec *timeout)
+{
+	return amc_uring_wait_port(xprt->priv, timeout);
+}
+
+static void amc_uring_flush(struct amc_transport *xprt)
+{
+	struct amc_uring_port *port = xprt->priv;
+
+	amc_uring_reap(port->ring);
+	port->rx_head = port->rx_len;
+	port->eof = 0;
+	serial_port_flush(port->fd);
+}
+
+/**
+\brief Cancel whatever a port has in flight and wait for it to finish
+*/
+static void amc_uring_quiesce(struct amc_uring_port *port)
+{
+	struct amc_uring *u = port->ring;
+	struct timespec timeout = { 1, 0 };
+	int kind;
+
+	amc_uring_reap(u);
+	/* The poll may already have fired, leaving the read blocked on a port
+	that was flushed since; cancel both */
+	for (kind = AMC_URING_POLL; port->read_armed && kind <= AMC_URING_READ; kind++) {
+		amc_uring_cancel(port, kind);
+	}
+	while (port->read_armed || port->write_busy || u->to_submit > 0) {
+		/* Gives up on ETIME, a stuck port must not hang the caller */
+		if (amc_uring_enter(u, 1, &timeout) < 0 && errno != EINTR && errno != EAGAIN &&
+			errno != EBUSY) {
+			break;
+		}
+		amc_uring_reap(u);
+	}
+}
+
+static void amc_uring_close(struct amc_transport *xprt)
+{
+	struct amc_uring_port *port = xprt->priv;
+	struct amc_uring *u = port->ring;
+
+	amc_uring_quiesce(port);
+	if (port->fixed_file) {
+		struct io_uring_files_update update;
+		int fd = -1;
+		memset(&update, 0, sizeof(update));
+		update.offset = port->index;
+		update.fds = (uint64_t)(uintptr_t)&fd;
+		amc_uring_register(u->ring_fd, IORING_REGISTER_FILES_UPDATE, &update, 1);
+	}
+	close(port->fd);
+	port->in_use = 0;
+	xprt->fd = -1;
+}
+
+static const struct amc_transport_ops amc_uring_ops = {
+	.writev = amc_uring_writev,
+	.readv = amc_uring_readv,
+	.wait = amc_uring_wait,
+	.flush = amc_uring_flush,
+	.close = amc_uring_close
+};
+
+/**
+\brief Create an io_uring shared by a number of ports
+\param max_ports Largest number of ports that will be open at once
+\return The ring, or NULL with errno set; ENOSYS if io_uring is not
+available, in which case amc_uring_transport(NULL, ...) gives tty
+transports instead
+
+Requires a kernel that can time out a wait on the ring (5.11 or later).
+Registering the port buffers needs enough locked memory
+(max_ports * 3 kB); when that is refused, plain reads and writes are
+used instead of fixed-buffer ones.
+*/
+struct amc_uring *amc_uring_new(int max_ports)
+{
+	struct io_uring_params params;
+	struct amc_uring *u;
+	struct iovec iov;
+	int *fds, ctr;
+	unsigned int entries = 8;
+
+	if (max_ports <= 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	u = calloc(1, sizeof(struct amc_uring));
+	if (u == NULL) {
+		return NULL;
+	}
+	u->max_ports = max_ports;
+
+	/* Room for a poll, a read, a write and a cancel per port */
+	while (entries < 4 * max_ports) {
+		entries *= 2;
+	}
+	memset(&params, 0, sizeof(params));
+	u->ring_fd = amc_uring_setup(entries, &params);
+	if (u->ring_fd < 0) {
+		if (errno == EPERM) {
+			errno = ENOSYS;
+		}
+		free(u);
+		return NULL;
+	}
+	if (!(params.features & IORING_FEAT_EXT_ARG)) {
+		close(u->ring_fd);
+		free(u);
+		errno = ENOSYS;
+		return NULL;
+	}
+
+	u->sq_entries = params.sq_entries;
+	u->poll_cqe = 1;
+#ifdef IORING_FEAT_CQE_SKIP
+	if (params.features & IORING_FEAT_CQE_SKIP) {
+		u->poll_cqe = 0;
+	}
+#endif
+	u->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	u->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (u->cq_ring_size > u->sq_ring_size) {
+			u->sq_ring_size = u->cq_ring_size;
+		}
+		u->cq_ring_size = u->sq_ring_size;
+	}
+	u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_SQ_RING);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		u->cq_ring = u->sq_ring;
+	}
+	else {
+		u->cq_ring = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_CQ_RING);
+	}
+	u->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_SQES);
+	u->buffers_size = (size_t)max_ports * AMC_URING_PORT_SIZE;
+	u->buffers = mmap(NULL, u->buffers_size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	u->ports = calloc(max_ports, sizeof(struct amc_uring_port));
+	if (u->sq_ring == MAP_FAILED || u->cq_ring == MAP_FAILED || u->sqes == MAP_FAILED ||
+		u->buffers == MAP_FAILED || u->ports == NULL) {
+		amc_uring_free(u);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	u->sq_head = (unsigned int *)((uint8_t *)u->sq_ring + params.sq_off.head);
+	u->sq_ktail = (unsigned int *)((uint8_t *)u->sq_ring + params.sq_off.tail);
+	u->sq_mask = (unsigned int *)((uint8_t *)u->sq_ring + params.sq_off.ring_mask);
+	u->sq_array = (unsigned int *)((uint8_t *)u->sq_ring + params.sq_off.array);
+	u->cq_head = (unsigned int *)((uint8_t *)u->cq_ring + params.cq_off.head);
+	u->cq_tail = (unsigned int *)((uint8_t *)u->cq_ring + params.cq_off.tail);
+	u->cq_mask = (unsigned int *)((uint8_t *)u->cq_ring + params.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)((uint8_t *)u->cq_ring + params.cq_off.cqes);
+	u->sq_tail = *u->sq_ktail;
+
+	for (ctr = 0; ctr < max_ports; ctr++) {
+		struct amc_uring_port *port = &u->ports[ctr];
+		port->ring = u;
+		port->index = ctr;
+		port->fd = -1;
+		port->rx = u->buffers + (size_t)ctr * AMC_URING_PORT_SIZE;
+		port->tx = port->rx + AMC_URING_RX_SIZE;
+	}
+
+	/* One registered buffer covers every port's receive and transmit area */
+	iov.iov_base = u->buffers;
+	iov.iov_len = u->buffers_size;
+	u->fixed_bufs = (0 == amc_uring_register(u->ring_fd, IORING_REGISTER_BUFFERS, &iov, 1));
+
+	/* Sparse file table, ports are put in it as they are opened */
+	fds = malloc(max_ports * sizeof(int));
+	if (fds != NULL) {
+		for (ctr = 0; ctr < max_ports; ctr++) {
+			fds[ctr] = -1;
+		}
+		if (0 == amc_uring_register(u->ring_fd, IORING_REGISTER_FILES, fds, max_ports)) {
+			for (ctr = 0; ctr < max_ports; ctr++) {
+				u->ports[ctr].fixed_file = -1;
+			}
+		}
+		free(fds);
+	}
+	return u;
+}
+
+/**
+\brief Destroy a ring created with amc_uring_new
+\param *u Ring to destroy, can be NULL
+
+All ports opened on the ring must have been closed with
+amc_transport_close first.
+*/
+void amc_uring_free(struct amc_uring *u)
+{
+	if (u == NULL) {
+		return;
+	}
+	if (u->buffers != NULL && u->buffers != MAP_FAILED) {
+		munmap(u->buffers, u->buffers_size);
+	}
+	if (u->sqes != NULL && u->sqes != MAP_FAILED) {
+		munmap(u->sqes, u->sqes_size);
+	}
+	if (u->cq_ring != NULL && u->cq_ring != MAP_FAILED && u->cq_ring != u->sq_ring) {
+		munmap(u->cq_ring, u->cq_ring_size);
+	}
+	if (u->sq_ring != NULL && u->sq_ring != MAP_FAILED) {
+		munmap(u->sq_ring, u->sq_ring_size);
+	}
+	close(u->ring_fd);
+	free(u->ports);
+	free(u);
+}
+
+/**
+\brief Set up a transport for a serial port on a shared ring
+\param *u Ring from amc_uring_new, or NULL to fall back to the tty transport
+\param *xprt Transport to initialize
+\param fd File descriptor of the serial port, as returned by amc_serial_open
+\return 1 if the port uses the ring, 0 if it fell back to the tty
+transport, -1 if all slots of the ring are taken
+
+Closing the transport closes fd and frees the slot.
+*/
+int amc_uring_transport(struct amc_uring *u, struct amc_transport *xprt, int fd)
+{
+	struct amc_uring_port *port = NULL;
+	int ctr;
+
+	assert(xprt != NULL);
+	if (u == NULL) {
+		serial_port_transport(xprt, fd);
+		return 0;
+	}
+	for (ctr = 0; ctr < u->max_ports; ctr++) {
+		if (!u->ports[ctr].in_use) {
+			port = &u->ports[ctr];
+			break;
+		}
+	}
+	if (port == NULL) {
+		errno = EMFILE;
+		return -1;
+	}
+
+	if (port->fixed_file) {
+		struct io_uring_files_update update;
+		memset(&update, 0, sizeof(update));
+		update.offset = port->index;
+		update.fds = (uint64_t)(uintptr_t)&fd;
+		port->fixed_file = (1 == amc_uring_register(u->ring_fd, IORING_REGISTER_FILES_UPDATE,
+			&update, 1)) ? -1 : 0;
+	}
+	port->fd = fd;
+	port->in_use = 1;
+	port->read_armed = port->write_busy = 0;
+	port->err = port->eof = 0;
+	port->rx_head = port->rx_len = 0;
+
+	xprt->ops = &amc_uring_ops;
+	xprt->fd = fd;
+	xprt->priv = port;
+	xprt->deadline = NULL;
+	return 1;
+}
+
+/**
+\brief Submit everything queued on a ring without waiting
+\param *u Ring, can be NULL
+\return 0 on success, -1 on failure
+*/
+int amc_uring_submit(struct amc_uring *u)
+{
+	if (u == NULL || u->to_submit == 0) {
+		return 0;
+	}
+	return (amc_uring_enter(u, 0, NULL) < 0) ? -1 : 0;
+}
+
+/**
+\brief Get the system call and request counts of a ring
+\param *u Ring, can be NULL
+\param *stats Set to the counts, zero if u is NULL
+*/
+void amc_uring_get_stats(const struct amc_uring *u, struct amc_uring_stats *stats)
+{
+	assert(stats != NULL);
+	if (u == NULL) {
+		memset(stats, 0, sizeof(struct amc_uring_stats));
+		return;
+	}
+	*stats = u->stats;
+}
+
+#else /* AMC_HAVE_IO_URING */
+
+struct amc_uring *amc_uring_new(int max_ports)
+{
+	errno = ENOSYS;
+	return NULL;
+}
+
+void amc_uring_free(struct amc_uring *u)
+{
+}
+
+int amc_uring_transport(struct amc_uring *u, struct amc_transport *xprt, int fd)
+{
+	assert(xprt != NULL);
+	serial_port_transport(xprt, fd);
+	return 0;
+}
+
+int amc_uring_submit(struct amc_uring *u)
+{
+	return 0;
+}
+
+void amc_uring_get_stats(const struct amc_uring *u, struct amc_uring_stats *stats)
+{
+	assert(stats != NULL);
+	memset(stats, 0, sizeof(struct amc_uring_stats));
+}
+
+#endif /* AMC_HAVE_IO_URING */
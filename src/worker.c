@@ -0,0 +1,425 @@
+/**
+\file src/worker.c
+\brief Bus worker thread for multi-threaded applications
+\author Jim George
+
+Nothing in amc.c may be called on one bus from two threads at once. A
+worker owns a bus instead: it runs a thread of its own that takes
+requests from any number of application threads and runs them one after
+the other with amc_transact. Application threads never hold a lock that
+the worker needs, so a low priority thread cannot stall the bus (or a
+high priority thread) by being preempted halfway through a transaction,
+as it can with a mutex around amc_get_string.
+
+Requests are handed over through an intrusive multi-producer single-
+consumer queue (Vyukov's): submitting is one atomic exchange and one
+store, without locks or allocation. The worker sleeps on an eventfd when
+the queue is empty, and producers only write to it when the worker has
+said it is about to sleep. A request completes either by calling its
+done callback from the worker thread, or by waking threads waiting in
+amc_request_wait on a futex.
+
+The worker moves requests off the queue into a list per priority class
+before picking the next one to run. Classes are strict priorities: a
+request of AMC_PRIO_CONTROL always goes before any AMC_PRIO_STATUS or
+AMC_PRIO_BACKGROUND request that is waiting. Within a class the earliest
+deadline goes first, requests without a deadline go after those with one,
+and ties keep submission order. A transaction that has started on the
+wire is never interrupted, so an urgent request can still wait for one
+transaction of lower priority to finish, and by default requests are run
+whole: more urgent requests only get in between them. At 115200 baud a
+long read can hold the bus for tens of milliseconds, so a read whose
+request sets word_addressed is split into reads of
+AMC_WORKER_SLICE_BYTES, and more urgent requests run between the slices.
+Each slice is issued at the offset of the request plus the words read so
+far, which is only right for indices where consecutive offsets are
+consecutive 16-bit words; many are not, such as 0x45, where each offset
+is a 32-bit parameter. Only set it for such spans, and only where the
+read need not be atomic. Writes are never split. Requests that complete
+after their deadline still run, and are counted as misses of their class
+(amc_worker_get_stats).
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "amc.h"
+
+/* Largest slice of a word addressed read done in one transaction, about
+5 ms of bus time at 115200 baud */
+#define AMC_WORKER_SLICE_BYTES 32
+
+struct amc_worker {
+	struct amc_bus *bus; /**< Bus the worker owns */
+	pthread_t thread; /**< Worker thread */
+	int efd; /**< Wakes the worker up */
+	int sleeping; /**< Nonzero while the worker is about to sleep or asleep */
+	int stop; /**< Set to make the worker exit */
+	struct amc_request *head; /**< Last request pushed, producers only */
+	struct amc_request *tail; /**< Next request to pop, worker only */
+	struct amc_request stub; /**< Keeps the queue from ever being empty */
+	struct amc_request *pending[AMC_PRIO_CLASSES]; /**< Taken off the queue, by deadline, worker only */
+	struct amc_request *pending_tail[AMC_PRIO_CLASSES]; /**< Last of each pending list */
+	struct amc_worker_stats stats; /**< Updated by the worker thread */
+};
+
+static long long amc_worker_now_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static void amc_worker_push(struct amc_worker *w, struct amc_request *req)
+{
+	struct amc_request *prev;
+
+	__atomic_store_n(&req->next, NULL, __ATOMIC_RELAXED);
+	prev = __atomic_exchange_n(&w->head, req, __ATOMIC_ACQ_REL);
+	/* Until this store the request is queued but cannot be popped yet */
+	__atomic_store_n(&prev->next, req, __ATOMIC_SEQ_CST);
+}
+
+/**
+\brief Take the oldest request off the queue
+\return The request, or NULL if the queue is empty or a push is half done
+*/
+static struct amc_request *amc_worker_pop(struct amc_worker *w)
+{
+	struct amc_request *tail = w->tail;
+	struct amc_request *next = __atomic_load_n(&tail->next, __ATOMIC_SEQ_CST);
+
+	if (tail == &w->stub) {
+		if (next == NULL) {
+			return NULL;
+		}
+		w->tail = next;
+		tail = next;
+		next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	}
+	if (next != NULL) {
+		w->tail = next;
+		return tail;
+	}
+	if (tail != __atomic_load_n(&w->head, __ATOMIC_ACQUIRE)) {
+		return NULL;
+	}
+	/* tail is the last request, put the stub behind it so it can go */
+	amc_worker_push(w, &w->stub);
+	next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	if (next != NULL) {
+		w->tail = next;
+		return tail;
+	}
+	return NULL;
+}
+
+/**
+\brief Add a request taken off the queue to the pending list of its class
+\param *w Worker
+\param *req Request, due_ns is LLONG_MAX if it has no deadline
+
+The list is kept sorted by deadline. Most requests of a class have the
+same relative deadline, or none, and go straight to the end.
+*/
+static void amc_worker_pend(struct amc_worker *w, struct amc_request *req)
+{
+	struct amc_request **link = &w->pending[req->priority];
+	struct amc_request *tail = w->pending_tail[req->priority];
+
+	if (tail != NULL && req->due_ns >= tail->due_ns) {
+		link = &tail->next;
+	}
+	else {
+		while (*link != NULL && (*link)->due_ns <= req->due_ns) {
+			link = &(*link)->next;
+		}
+	}
+	req->next = *link;
+	*link = req;
+	if (req->next == NULL) {
+		w->pending_tail[req->priority] = req;
+	}
+}
+
+/**
+\brief Put a request back at the head of the pending list of its class
+*/
+static void amc_worker_pend_front(struct amc_worker *w, struct amc_request *req)
+{
+	req->next = w->pending[req->priority];
+	w->pending[req->priority] = req;
+	if (req->next == NULL) {
+		w->pending_tail[req->priority] = req;
+	}
+}
+
+/**
+\brief Take the next request to run off the pending lists
+\return The request, or NULL if none are pending
+*/
+static struct amc_request *amc_worker_next(struct amc_worker *w)
+{
+	struct amc_request *req;
+	int prio;
+
+	for (prio = 0; prio < AMC_PRIO_CLASSES; prio++) {
+		req = w->pending[prio];
+		if (req != NULL) {
+			w->pending[prio] = req->next;
+			if (req->next == NULL) {
+				w->pending_tail[prio] = NULL;
+			}
+			return req;
+		}
+	}
+	return NULL;
+}
+
+static void amc_worker_wake(struct amc_worker *w)
+{
+	uint64_t one = 1;
+
+	while (write(w->efd, &one, sizeof(one)) == -1 && errno == EINTR);
+}
+
+/**
+\brief Hand a request its result and wake whoever waits for it
+*/
+static void amc_request_complete(struct amc_worker *w, struct amc_request *req, int result)
+{
+	__atomic_fetch_add(&w->stats.completed[req->priority], 1, __ATOMIC_RELAXED);
+	if (amc_worker_now_ns() > req->due_ns) {
+		__atomic_fetch_add(&w->stats.missed[req->priority], 1, __ATOMIC_RELAXED);
+	}
+	req->result = result;
+	if (req->done != NULL) {
+		/* The callback owns the request from here on */
+		req->done(req);
+		return;
+	}
+	__atomic_store_n(&req->state, 1, __ATOMIC_RELEASE);
+	syscall(SYS_futex, &req->state, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/**
+\brief Run a request, or the next slice of it
+\param *w Worker
+\param *req Request taken off the pending lists
+
+A sliced read that is not finished goes back to the head of its pending
+list, everything else completes.
+*/
+static void amc_worker_run(struct amc_worker *w, struct amc_request *req)
+{
+	int len = req->buffer_len - req->progress;
+	int ret;
+
+	if (!req->word_addressed || req->access_type != AMC_CMDTYPE_READ ||
+		req->buffer_len <= AMC_WORKER_SLICE_BYTES) {
+		amc_request_complete(w, req, amc_transact(req->drv, req->access_type,
+			req->index, req->offset, req->payload, req->payload_len,
+			req->buffer, req->buffer_len));
+		return;
+	}
+	if (len > AMC_WORKER_SLICE_BYTES) {
+		len = AMC_WORKER_SLICE_BYTES;
+	}
+
+	/* The caller has said that offsets count 16-bit words */
+	ret = amc_transact(req->drv, AMC_CMDTYPE_READ, req->index,
+		req->offset + req->progress / sizeof(uint16_t), NULL, 0,
+		(uint8_t *)req->buffer + req->progress, len);
+	if (ret < 0) {
+		amc_request_complete(w, req, ret);
+		return;
+	}
+	req->progress += len;
+	if (req->progress < req->buffer_len) {
+		amc_worker_pend_front(w, req);
+		return;
+	}
+	/* The same as for a read in one piece: one header, all of the payload */
+	amc_request_complete(w, req, ret + req->buffer_len - len);
+}
+
+static void *amc_worker_thread(void *arg)
+{
+	struct amc_worker *w = arg;
+	struct amc_request *req;
+	uint64_t count;
+
+	while (!__atomic_load_n(&w->stop, __ATOMIC_ACQUIRE)) {
+		while (NULL != (req = amc_worker_pop(w))) {
+			amc_worker_pend(w, req);
+		}
+		req = amc_worker_next(w);
+		if (req == NULL) {
+			/* Announce the sleep, then look once more: a producer either
+			sees the flag or its request is seen here */
+			__atomic_store_n(&w->sleeping, 1, __ATOMIC_SEQ_CST);
+			req = amc_worker_pop(w);
+			if (req == NULL && !__atomic_load_n(&w->stop, __ATOMIC_SEQ_CST)) {
+				while (read(w->efd, &count, sizeof(count)) == -1 && errno == EINTR);
+			}
+			__atomic_store_n(&w->sleeping, 0, __ATOMIC_RELAXED);
+			if (req != NULL) {
+				amc_worker_pend(w, req);
+			}
+			continue;
+		}
+		amc_worker_run(w, req);
+	}
+	return NULL;
+}
+
+/**
+\brief Start a worker thread for a bus
+\param *bus Bus the worker takes over, with drives attached as needed
+\return The worker, or NULL with errno set on failure
+
+From here until amc_worker_free, the bus and its drives must only be used
+through amc_worker_submit. Settings of the drives (timeouts, retry
+policy) should be made before the worker starts.
+*/
+struct amc_worker *amc_worker_new(struct amc_bus *bus)
+{
+	struct amc_worker *w;
+	int ret;
+
+	assert(bus != NULL);
+	w = calloc(1, sizeof(struct amc_worker));
+	if (w == NULL) {
+		return NULL;
+	}
+	w->bus = bus;
+	w->head = w->tail = &w->stub;
+	w->efd = eventfd(0, EFD_CLOEXEC);
+	if (w->efd == -1) {
+		free(w);
+		return NULL;
+	}
+	ret = pthread_create(&w->thread, NULL, amc_worker_thread, w);
+	if (ret != 0) {
+		close(w->efd);
+		free(w);
+		errno = ret;
+		return NULL;
+	}
+	return w;
+}
+
+/**
+\brief Stop a worker thread
+\param *w Worker, can be NULL
+
+The request in progress is finished, requests still queued complete with
+AMC_ECANCELED, in the order they would have run. No request may be submitted once this has been called. The
+bus is not destroyed.
+*/
+void amc_worker_free(struct amc_worker *w)
+{
+	struct amc_request *req;
+
+	if (w == NULL) {
+		return;
+	}
+	__atomic_store_n(&w->stop, 1, __ATOMIC_SEQ_CST);
+	amc_worker_wake(w);
+	pthread_join(w->thread, NULL);
+
+	/* A push can no longer be half done, the queue empties completely */
+	while (NULL != (req = amc_worker_pop(w))) {
+		amc_worker_pend(w, req);
+	}
+	while (NULL != (req = amc_worker_next(w))) {
+		amc_request_complete(w, req, AMC_ECANCELED);
+	}
+	close(w->efd);
+	free(w);
+}
+
+/**
+\brief Queue a request on a bus worker
+\param *w Worker
+\param *req Request, see struct amc_request
+\return AMC_EOK if queued, AMC_EPORT if the drive is not on the worker's bus
+
+Safe to call from any thread, including from a done callback; never
+blocks. The deadline of the request starts counting here.
+*/
+int amc_worker_submit(struct amc_worker *w, struct amc_request *req)
+{
+	assert(w != NULL);
+	assert(req != NULL && req->drv != NULL);
+	assert(req->priority >= 0 && req->priority < AMC_PRIO_CLASSES);
+
+	if (req->drv->bus != w->bus) {
+		return AMC_EPORT;
+	}
+	req->due_ns = (req->deadline_us > 0) ?
+		amc_worker_now_ns() + req->deadline_us * 1000LL : LLONG_MAX;
+	req->result = 0;
+	req->state = 0;
+	req->progress = 0;
+	amc_worker_push(w, req);
+	if (__atomic_load_n(&w->sleeping, __ATOMIC_SEQ_CST)) {
+		amc_worker_wake(w);
+	}
+	return AMC_EOK;
+}
+
+/**
+\brief Wait for a request without a done callback to complete
+\param *req Request submitted with amc_worker_submit
+\return The result of the request, as returned by amc_transact
+
+Any number of threads may wait for the same request.
+*/
+int amc_request_wait(struct amc_request *req)
+{
+	assert(req != NULL && req->done == NULL);
+	while (!__atomic_load_n(&req->state, __ATOMIC_ACQUIRE)) {
+		syscall(SYS_futex, &req->state, FUTEX_WAIT_PRIVATE, 0, NULL, NULL, 0);
+	}
+	return req->result;
+}
+
+/**
+\brief Check whether a request without a done callback has completed
+\param *req Request submitted with amc_worker_submit
+\return Nonzero once req->result is valid
+*/
+int amc_request_done(const struct amc_request *req)
+{
+	assert(req != NULL);
+	return __atomic_load_n(&req->state, __ATOMIC_ACQUIRE);
+}
+
+/**
+\brief Get the completion and deadline miss counts of a worker
+\param *w Worker
+\param *stats Where to store the counts
+
+Can be called from any thread while the worker runs.
+*/
+void amc_worker_get_stats(struct amc_worker *w, struct amc_worker_stats *stats)
+{
+	int prio;
+
+	assert(w != NULL && stats != NULL);
+	for (prio = 0; prio < AMC_PRIO_CLASSES; prio++) {
+		stats->completed[prio] = __atomic_load_n(&w->stats.completed[prio], __ATOMIC_RELAXED);
+		stats->missed[prio] = __atomic_load_n(&w->stats.missed[prio], __ATOMIC_RELAXED);
+	}
+}
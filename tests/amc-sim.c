@@ -0,0 +1,695 @@
+/**
+\file tests/amc-sim.c
+\brief Simulator of AMC servo drives on a pseudo-terminal
+\author Jim George
+
+Opens a pseudo-terminal and answers AMC command frames written to it as
+one or more drives, so the library can be exercised and benchmarked
+without hardware. Each drive has a register file of 256 indices of 256
+words, addressed by the index and offset fields of the command.
+
+READ commands return payload_len words starting at the offset, WRITE
+commands store the payload, READWRITE commands store the payload and
+return the register contents after the write. Commands to the broadcast
+address are executed by every drive without a response, commands to
+addresses with no drive are ignored. Frames with a bad header CRC are
+dropped; the status byte of the response reports a bad payload CRC
+(AMC_CMDRESP_FRAMEERR), an unknown command type or a range outside the
+register file (AMC_CMDRESP_INVALID), writes made before access was
+granted through index 0x07 when --access is given (AMC_CMDRESP_NOACCESS),
+and every n-th command when --incomplete=n is given
+(AMC_CMDRESP_INCOMPLETE).
+
+Turnaround latency and the baud rate are configurable. With a baud rate
+set, commands are taken to arrive at the rate the line could carry them
+and responses are sent no faster than it, so transactions take as long
+as they would on a real bus.
+
+The name of the slave side of the pseudo-terminal is printed on the
+first line of output; open it with amc_serial_open like any serial port.
+With --tcp the simulator stands in for a serial device server instead,
+serving one TCP client at a time, and prints the address it listens on.
+*/
+
+#define _GNU_SOURCE /* for posix_openpt and ptsname */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <getopt.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <config.h>
+
+#include "src/amc.h"
+#include "src/crc.h"
+
+#define SIM_MAX_ADDRESS 0x3F
+#define SIM_NUM_INDEX 256
+#define SIM_INDEX_WORDS 256
+#define SIM_ACCESS_INDEX 0x07
+
+/* Largest command frame: header, maximum payload and payload CRC */
+#define SIM_FRAME_MAX (sizeof(struct amc_command) + AMC_MAX_PAYLOAD + sizeof(uint16_t))
+
+struct sim_drive {
+	int address; /**< Bus address of the drive */
+	int access; /**< Nonzero once write access has been granted */
+	uint16_t regs[SIM_NUM_INDEX][SIM_INDEX_WORDS]; /**< Register file, as on the wire */
+};
+
+static struct sim_drive *drives[SIM_MAX_ADDRESS + 1];
+
+static int latency_us = 0;
+static int baud = 0;
+static int require_access = 0;
+static int incomplete_every = 0;
+static int verbose = 0;
+static const char *link_path = NULL;
+static volatile sig_atomic_t stop = 0;
+
+static struct {
+	unsigned long frames; /**< Command frames received */
+	unsigned long responses; /**< Responses sent */
+	unsigned long header_errors; /**< Bytes dropped while looking for a valid header */
+	unsigned long payload_errors; /**< Frames with a bad payload CRC */
+	unsigned long ignored; /**< Frames for addresses with no drive */
+} stats;
+
+/* Times at which the line in each direction is free again */
+static struct timespec rx_free, tx_free;
+
+static void ts_add_us(struct timespec *ts, long us)
+{
+	ts->tv_sec += us / 1000000;
+	ts->tv_nsec += (us % 1000000) * 1000L;
+	if (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000L;
+	}
+}
+
+static int ts_before(const struct timespec *a, const struct timespec *b)
+{
+	return (a->tv_sec < b->tv_sec) ||
+		((a->tv_sec == b->tv_sec) && (a->tv_nsec < b->tv_nsec));
+}
+
+static void sleep_until(const struct timespec *ts)
+{
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, ts, NULL) == EINTR && !stop);
+}
+
+/**
+\brief Time a number of bytes takes on the line
+\param bytes Number of bytes
+\return Time in microseconds, 0 if no baud rate is set
+*/
+static long wire_us(int bytes)
+{
+	if (baud <= 0) {
+		return 0;
+	}
+	return (long)bytes * AMC_BITS_PER_BYTE * 1000000L / baud;
+}
+
+/**
+\brief Add a drive at the given address
+\param address Bus address, 0x01 to 0x3F
+\return The new drive, or NULL if the address is invalid or taken
+
+The drive name (index 0x0B) and product information (index 0x8C) are
+filled in so that identification queries get a sensible answer.
+*/
+static struct sim_drive *sim_drive_add(int address)
+{
+	struct sim_drive *drv;
+	struct amc_product_info *pi;
+
+	if (address < 1 || address > SIM_MAX_ADDRESS || drives[address] != NULL) {
+		return NULL;
+	}
+	drv = calloc(1, sizeof(struct sim_drive));
+	if (drv == NULL) {
+		return NULL;
+	}
+	drv->address = address;
+	drv->access = !require_access;
+
+	snprintf((char *)drv->regs[0x0B], sizeof(drv->regs[0x0B]), "AMC simulator %02X", address);
+	pi = (struct amc_product_info *)drv->regs[0x8C];
+	snprintf((char *)pi->control_board_name, sizeof(pi->control_board_name), "amc-sim");
+	snprintf((char *)pi->control_board_version, sizeof(pi->control_board_version), "%s", PACKAGE_VERSION);
+	snprintf((char *)pi->product_part_number, sizeof(pi->product_part_number), "SIM-%02X", address);
+	snprintf((char *)pi->product_version, sizeof(pi->product_version), "%s", PACKAGE_VERSION);
+
+	drives[address] = drv;
+	return drv;
+}
+
+/**
+\brief Load register values into a drive from a file
+\param *drv Drive to load
+\param *path File to read
+\return 0 on success, -1 on failure
+
+Each line holds an index, an offset and one or more 16-bit words, all in
+hex, stored at consecutive offsets. Everything after a '#' is ignored.
+*/
+static int sim_drive_load(struct sim_drive *drv, const char *path)
+{
+	FILE *file = fopen(path, "r");
+	char line[1024];
+	int line_no = 0;
+
+	if (file == NULL) {
+		perror(path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), file) != NULL) {
+		char *pos = line, *end;
+		unsigned long index, offset, value;
+
+		line_no++;
+		if ((end = strchr(line, '#')) != NULL) {
+			*end = '\0';
+		}
+		index = strtoul(pos, &end, 16);
+		if (end == pos) continue;
+		pos = end;
+		offset = strtoul(pos, &end, 16);
+		if (end == pos || index >= SIM_NUM_INDEX) {
+			fprintf(stderr, "%s:%d: expected index and offset\n", path, line_no);
+			fclose(file);
+			return -1;
+		}
+		for (pos = end; ; pos = end, offset++) {
+			value = strtoul(pos, &end, 16);
+			if (end == pos) break;
+			if (offset >= SIM_INDEX_WORDS || value > 0xFFFF) {
+				fprintf(stderr, "%s:%d: value out of range\n", path, line_no);
+				fclose(file);
+				return -1;
+			}
+			drv->regs[index][offset] = amc_int16_to_le(value);
+		}
+	}
+	fclose(file);
+	return 0;
+}
+
+/**
+\brief Execute a command on one drive
+\param *drv Drive to execute the command on
+\param *cmd Command header
+\param *payload Payload sent with the command
+\param payload_ok Nonzero if the payload CRC matched
+\return One of AMC_CMDRESP_*
+*/
+static int sim_drive_execute(struct sim_drive *drv, const struct amc_command *cmd,
+	const uint8_t *payload, int payload_ok)
+{
+	static unsigned long executed;
+	int type = cmd->control.bits.cmd;
+
+	if (!payload_ok) {
+		return AMC_CMDRESP_FRAMEERR;
+	}
+	if (type == 0 || cmd->payload_len == 0 ||
+		cmd->offset + cmd->payload_len > SIM_INDEX_WORDS) {
+		return AMC_CMDRESP_INVALID;
+	}
+	if ((type & AMC_CMDTYPE_WRITE) && !drv->access && cmd->index != SIM_ACCESS_INDEX) {
+		return AMC_CMDRESP_NOACCESS;
+	}
+	if (incomplete_every > 0 && (++executed % incomplete_every) == 0) {
+		return AMC_CMDRESP_INCOMPLETE;
+	}
+	if (type & AMC_CMDTYPE_WRITE) {
+		memcpy(&drv->regs[cmd->index][cmd->offset], payload, cmd->payload_len * sizeof(uint16_t));
+		if (cmd->index == SIM_ACCESS_INDEX) {
+			drv->access = !require_access || drv->regs[SIM_ACCESS_INDEX][0] != 0;
+		}
+	}
+	return AMC_CMDRESP_COMPLETE;
+}
+
+/**
+\brief Write a response, paced at the configured baud rate
+\param fd Line to write to
+\param *buf Response frame
+\param len Length of the frame
+*/
+static void sim_send(int fd, const uint8_t *buf, int len)
+{
+	struct timespec start = tx_free;
+	int sent = 0, chunk;
+
+	/* Without a baud rate the whole frame goes out at once; otherwise in
+	chunks of about a millisecond of line time */
+	chunk = (baud > 0) ? baud / AMC_BITS_PER_BYTE / 1000 + 1 : len;
+	while (sent < len && !stop) {
+		int n = (len - sent < chunk) ? len - sent : chunk;
+		ssize_t ret = write(fd, buf + sent, n);
+		if (ret < 0) {
+			if (errno == EINTR || errno == EAGAIN) continue;
+			perror("write");
+			return;
+		}
+		sent += ret;
+		if (baud > 0) {
+			struct timespec next = start;
+			ts_add_us(&next, wire_us(sent));
+			sleep_until(&next);
+		}
+	}
+	ts_add_us(&tx_free, wire_us(len));
+}
+
+/**
+\brief Execute a command frame and send the response
+\param fd Line to answer on
+\param *frame Command frame, header valid
+\param len Length of the frame
+\param *arrived When the last byte of the frame was read
+*/
+static void sim_handle(int fd, const uint8_t *frame, int len, const struct timespec *arrived)
+{
+	const struct amc_command *cmd = (const struct amc_command *)frame;
+	const uint8_t *payload = frame + sizeof(struct amc_command);
+	uint8_t out[SIM_FRAME_MAX];
+	struct amc_response *rsp = (struct amc_response *)out;
+	struct sim_drive *drv;
+	struct timespec due;
+	int payload_ok = 1, status, out_len = sizeof(struct amc_response);
+
+	stats.frames++;
+	if (cmd->control.bits.cmd & AMC_CMDTYPE_WRITE) {
+		uint16_t crc;
+		memcpy(&crc, payload + cmd->payload_len * sizeof(uint16_t), sizeof(crc));
+		payload_ok = (amc_crc_update(0, payload, cmd->payload_len * sizeof(uint16_t)) == ntohs(crc));
+		if (!payload_ok) {
+			stats.payload_errors++;
+		}
+	}
+
+	/* The command occupies the line for its wire time after whatever came
+	before it, the drive answers latency_us after the last byte */
+	if (ts_before(&rx_free, arrived)) {
+		rx_free = *arrived;
+	}
+	ts_add_us(&rx_free, wire_us(len));
+
+	if (cmd->addr == 0x00) {
+		int address;
+		for (address = 1; address <= SIM_MAX_ADDRESS; address++) {
+			if (drives[address] != NULL) {
+				sim_drive_execute(drives[address], cmd, payload, payload_ok);
+			}
+		}
+		return;
+	}
+	drv = (cmd->addr <= SIM_MAX_ADDRESS) ? drives[cmd->addr] : NULL;
+	if (drv == NULL) {
+		stats.ignored++;
+		return;
+	}
+
+	status = sim_drive_execute(drv, cmd, payload, payload_ok);
+
+	rsp->sof = AMC_SOF_BYTE;
+	rsp->addr = 0xFF;
+	rsp->control.byte = 0;
+	rsp->control.bits.seq = cmd->control.bits.seq;
+	rsp->status1 = status;
+	rsp->status2 = 0;
+	rsp->payload_len = 0;
+	if (status == AMC_CMDRESP_COMPLETE && (cmd->control.bits.cmd & AMC_CMDTYPE_READ)) {
+		int bytes = cmd->payload_len * sizeof(uint16_t);
+		uint16_t crc;
+		rsp->control.bits.cmd = AMC_CMDTYPE_WRITE;
+		rsp->payload_len = cmd->payload_len;
+		memcpy(out + out_len, &drv->regs[cmd->index][cmd->offset], bytes);
+		crc = htons(amc_crc_update(0, out + out_len, bytes));
+		out_len += bytes;
+		memcpy(out + out_len, &crc, sizeof(crc));
+		out_len += sizeof(crc);
+	}
+	else {
+		rsp->control.bits.cmd = AMC_CMDTYPE_READ;
+	}
+	rsp->crc = htons(amc_crc_update(0, rsp, sizeof(struct amc_response) - sizeof(uint16_t)));
+
+	if (verbose) {
+		fprintf(stderr, "%02X: type %d %02X:%02X len %d -> status %d\n", cmd->addr,
+			cmd->control.bits.cmd, cmd->index, cmd->offset, cmd->payload_len, status);
+	}
+
+	due = rx_free;
+	ts_add_us(&due, latency_us);
+	if (ts_before(&tx_free, &due)) {
+		tx_free = due;
+	}
+	sleep_until(&tx_free);
+	sim_send(fd, out, out_len);
+	stats.responses++;
+}
+
+/**
+\brief Take complete command frames out of the receive buffer
+\param fd Line to answer on
+\param *buf Receive buffer
+\param *len Number of bytes in the buffer, updated
+\param *arrived When the bytes were read
+
+Scans for a start of frame with a valid header CRC, dropping bytes one at
+a time otherwise, and handles every complete frame found.
+*/
+static void sim_decode(int fd, uint8_t *buf, int *len, const struct timespec *arrived)
+{
+	int pos = 0;
+
+	while (*len - pos >= (int)sizeof(struct amc_command)) {
+		const struct amc_command *cmd = (const struct amc_command *)(buf + pos);
+		int frame_len = sizeof(struct amc_command);
+
+		if (cmd->sof != AMC_SOF_BYTE ||
+			amc_crc_update(0, cmd, sizeof(struct amc_command) - sizeof(uint16_t)) != ntohs(cmd->crc)) {
+			stats.header_errors++;
+			pos++;
+			continue;
+		}
+		if (cmd->control.bits.cmd & AMC_CMDTYPE_WRITE) {
+			frame_len += cmd->payload_len * sizeof(uint16_t) + sizeof(uint16_t);
+		}
+		if (*len - pos < frame_len) {
+			break;
+		}
+		sim_handle(fd, buf + pos, frame_len, arrived);
+		pos += frame_len;
+	}
+	memmove(buf, buf + pos, *len - pos);
+	*len -= pos;
+}
+
+/**
+\brief Answer commands on a line until told to stop
+\param fd Line to serve
+\return 0 when stopped, -1 on error
+*/
+static int sim_serve(int fd)
+{
+	static uint8_t buf[4 * SIM_FRAME_MAX];
+	int len = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &rx_free);
+	tx_free = rx_free;
+
+	while (!stop) {
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		struct timespec arrived;
+		ssize_t ret;
+
+		ret = poll(&pfd, 1, 1000);
+		if (ret < 0 && errno != EINTR) {
+			perror("poll");
+			return -1;
+		}
+		if (ret <= 0) continue;
+
+		ret = read(fd, buf + len, sizeof(buf) - len);
+		if (ret < 0) {
+			if (errno == EINTR || errno == EAGAIN) continue;
+			/* The master side reports EIO while no client has the slave
+			open, that is not an error for the simulator */
+			if (errno == EIO) {
+				usleep(10000);
+				continue;
+			}
+			if (errno == ECONNRESET) {
+				return 0;
+			}
+			perror("read");
+			return -1;
+		}
+		if (ret == 0) {
+			return 0;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &arrived);
+		len += ret;
+		sim_decode(fd, buf, &len, &arrived);
+		if (len == sizeof(buf)) {
+			/* Cannot happen with a valid frame in the buffer, only noise */
+			stats.header_errors += len;
+			len = 0;
+		}
+	}
+	return 0;
+}
+
+/**
+\brief Open a pseudo-terminal in raw mode
+\param *slave_fd Set to a descriptor of the slave side, kept open so the
+master does not see a hangup between clients
+\return Descriptor of the master side, or -1 on failure
+*/
+static int sim_open_pty(int *slave_fd)
+{
+	struct termios term_st;
+	int master;
+
+	master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) || unlockpt(master)) {
+		perror("posix_openpt");
+		return -1;
+	}
+	*slave_fd = open(ptsname(master), O_RDWR | O_NOCTTY);
+	if (*slave_fd < 0 || tcgetattr(*slave_fd, &term_st)) {
+		perror(ptsname(master));
+		return -1;
+	}
+	cfmakeraw(&term_st);
+	tcsetattr(*slave_fd, TCSANOW, &term_st);
+	return master;
+}
+
+/**
+\brief Listen for TCP connections
+\param *spec Port to listen on, optionally preceded by an address and a
+colon. The address defaults to 127.0.0.1, port 0 picks a free port
+\return Listening socket, or -1 on failure
+
+The address actually listened on is printed as host:port.
+*/
+static int sim_listen(char *spec)
+{
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof(addr);
+	char *colon = strrchr(spec, ':');
+	int fd, one = 1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (colon != NULL) {
+		*colon = '\0';
+		if (!inet_aton(spec, &addr.sin_addr)) {
+			fprintf(stderr, "Invalid address %s\n", spec);
+			return -1;
+		}
+		spec = colon + 1;
+	}
+	addr.sin_port = htons(atoi(spec));
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, 1) ||
+		getsockname(fd, (struct sockaddr *)&addr, &addrlen)) {
+		perror("bind");
+		close(fd);
+		return -1;
+	}
+	printf("%s:%d\n", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+	fflush(stdout);
+	return fd;
+}
+
+/**
+\brief Serve TCP clients one after the other until told to stop
+\param listen_fd Listening socket
+\return 0 when stopped, -1 on error
+*/
+static int sim_serve_tcp(int listen_fd)
+{
+	while (!stop) {
+		int fd, one = 1;
+
+		fd = accept(listen_fd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR) continue;
+			perror("accept");
+			return -1;
+		}
+		/* Responses go out as soon as they are written, a frame at a time */
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		if (sim_serve(fd)) {
+			close(fd);
+			return -1;
+		}
+		close(fd);
+	}
+	return 0;
+}
+
+static void on_signal(int sig)
+{
+	stop = 1;
+}
+
+char *usage_string =
+"Simulate AMC servo drives on a pseudo-terminal\n"
+"Usage:\n"
+"--drive=<addr>[,file]: Add a drive at hex address addr (01-3F), optionally\n"
+"        loading its registers from file (lines of hex index offset words...).\n"
+"        Defaults to a single drive at 3F\n"
+"--latency=<us>: Turnaround time of the drives in microseconds (default 0)\n"
+"--baud=<n>: Pace commands and responses at n baud (default: no pacing)\n"
+"--access: Refuse writes until access is granted through index 07\n"
+"--incomplete=<n>: Answer every n-th command with status INCOMPLETE\n"
+"--link=<path>: Create a symbolic link to the pseudo-terminal at path\n"
+"--tcp=[addr:]port: Listen on TCP instead of a pseudo-terminal, like a serial\n"
+"        device server (address defaults to 127.0.0.1, port 0 picks one)\n"
+"--verbose: Log every command to stderr\n"
+"\n"
+"The pseudo-terminal name is printed on the first line of output.\n"
+;
+
+static struct option opt_lst[] = {
+	{"drive", required_argument, 0, 'd'},
+	{"latency", required_argument, 0, 'l'},
+	{"baud", required_argument, 0, 'b'},
+	{"access", no_argument, 0, 'a'},
+	{"incomplete", required_argument, 0, 'i'},
+	{"link", required_argument, 0, 'L'},
+	{"tcp", required_argument, 0, 't'},
+	{"verbose", no_argument, 0, 'v'},
+	{"help", no_argument, 0, 'h'},
+	{NULL, 0, 0, 0}
+};
+
+int main(int argc, char *argv[])
+{
+	struct sigaction sa;
+	int opt, opt_idx, num_drives = 0;
+	int master, slave = -1, ret;
+	char *drive_args[SIM_MAX_ADDRESS];
+	char *tcp_spec = NULL;
+
+	while (-1 != (opt = getopt_long(argc, argv, "d:l:b:ai:L:t:vh", opt_lst, &opt_idx))) {
+		switch (opt) {
+		case 'd':
+			if (num_drives == SIM_MAX_ADDRESS) {
+				fprintf(stderr, "Too many drives\n");
+				return -1;
+			}
+			drive_args[num_drives++] = optarg;
+			break;
+		case 'l':
+			latency_us = atoi(optarg);
+			break;
+		case 'b':
+			baud = atoi(optarg);
+			break;
+		case 'a':
+			require_access = 1;
+			break;
+		case 'i':
+			incomplete_every = atoi(optarg);
+			break;
+		case 'L':
+			link_path = optarg;
+			break;
+		case 't':
+			tcp_spec = optarg;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			puts(usage_string);
+			return (opt == 'h') ? 0 : -1;
+		}
+	}
+
+	/* Drives are added once all options are known, --access applies to all */
+	if (num_drives == 0) {
+		sim_drive_add(0x3F);
+	}
+	for (opt = 0; opt < num_drives; opt++) {
+		char *file;
+		struct sim_drive *drv = sim_drive_add(strtol(drive_args[opt], &file, 16));
+		if (drv == NULL) {
+			fprintf(stderr, "Invalid or duplicate drive address %s\n", drive_args[opt]);
+			return -1;
+		}
+		if (*file == ',' && sim_drive_load(drv, file + 1)) {
+			return -1;
+		}
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	/* A client going away must not end the simulator */
+	signal(SIGPIPE, SIG_IGN);
+
+	if (tcp_spec != NULL) {
+		master = sim_listen(tcp_spec);
+		if (master < 0) {
+			return 1;
+		}
+		link_path = NULL;
+		ret = sim_serve_tcp(master);
+	}
+	else {
+		master = sim_open_pty(&slave);
+		if (master < 0) {
+			return 1;
+		}
+		if (link_path != NULL) {
+			unlink(link_path);
+			if (symlink(ptsname(master), link_path)) {
+				perror(link_path);
+				return 1;
+			}
+		}
+		printf("%s\n", ptsname(master));
+		fflush(stdout);
+		ret = sim_serve(master);
+	}
+
+	if (link_path != NULL) {
+		unlink(link_path);
+	}
+	fprintf(stderr, "frames %lu responses %lu header_errors %lu payload_errors %lu ignored %lu\n",
+		stats.frames, stats.responses, stats.header_errors, stats.payload_errors, stats.ignored);
+	if (slave >= 0) {
+		close(slave);
+	}
+	close(master);
+	return ret ? 1 : 0;
+}
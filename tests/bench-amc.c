@@ -0,0 +1,1269 @@
+/**
+\file tests/bench-amc.c
+\brief CRC and frame codec microbenchmarks for the AMC drive library
+\author Jim George
+
+Measures CRC throughput of every CRC engine over the range of block sizes
+seen on the wire, from the 6 byte header CRC span up to the 510 byte
+maximum payload, and the rate at which command frames can be encoded and
+response frames decoded with no I/O. Every engine is first checked
+against known answers, the program exits with an error if any of them
+disagree.
+
+Given a port with --port, whole transactions are timed against the drive
+at address 0x3F instead, typically the amc-sim simulator. Faults can be
+injected into the responses to see how goodput and tail latency degrade;
+the latency percentiles of each transaction type go to stderr.
+
+Results are printed one per line as comma separated values, with a
+header line, so they can be collected and compared between releases.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "src/amc.h"
+#include "src/crc.h"
+
+typedef uint16_t (*crc_engine_fn)(uint16_t crc, const void *buf, size_t len);
+
+static uint16_t crc_bytewise(uint16_t crc, const void *buf, size_t len)
+{
+	const uint8_t *p = (const uint8_t *)buf;
+	const uint16_t *table = amc_crc_table();
+
+	while (len--) {
+		amc_crc_check_word(*p++, &crc, table);
+	}
+	return crc;
+}
+
+static struct {
+	const char *name;
+	crc_engine_fn fn;
+	int available;
+} engines[] = {
+	{"bytewise", crc_bytewise, 1},
+	{"slice8", amc_crc_update_slice8, 1},
+#ifdef AMC_CRC_HAVE_CLMUL
+	{"clmul", amc_crc_update_clmul, 0},
+#endif
+	{"auto", amc_crc_update, 1},
+};
+#define NUM_ENGINES (sizeof(engines) / sizeof(engines[0]))
+
+static const int block_sizes[] = {6, 8, 16, 32, 64, 128, 256, 356, 510};
+#define NUM_BLOCK_SIZES (sizeof(block_sizes) / sizeof(block_sizes[0]))
+
+static double min_seconds = 0.2;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Keeps the compiler from dropping benchmark loops */
+static volatile uint16_t sink;
+
+static void report(const char *kind, const char *name, int size, long iterations, double seconds)
+{
+	double ns_per_op = seconds * 1e9 / iterations;
+	printf("%s,%s,%d,%ld,%.2f,%.0f,%.2f\n", kind, name, size, iterations, ns_per_op,
+		iterations / seconds, size ? (double)size * iterations / seconds / 1e6 : 0.0);
+}
+
+/**
+\brief Check every engine against known answers
+\return Number of failed checks
+*/
+static int check_engines(void)
+{
+	static const char check_string[] = "123456789";
+	uint8_t buffer[512];
+	int ctr, len, eng, failures = 0;
+
+	srand(1);
+	for (ctr = 0; ctr < sizeof(buffer); ctr++) {
+		buffer[ctr] = rand();
+	}
+
+	for (eng = 0; eng < NUM_ENGINES; eng++) {
+		if (!engines[eng].available) continue;
+
+		/* CRC-16/XMODEM check value for the AMC polynomial */
+		if (engines[eng].fn(0, check_string, 9) != 0x31C3) {
+			fprintf(stderr, "%s: check string failed\n", engines[eng].name);
+			failures++;
+		}
+		for (len = 0; len <= sizeof(buffer); len++) {
+			uint16_t seed = len * 0x9E37;
+			if (engines[eng].fn(seed, buffer, len) != crc_bytewise(seed, buffer, len)) {
+				fprintf(stderr, "%s: mismatch at length %d\n", engines[eng].name, len);
+				failures++;
+			}
+		}
+	}
+	return failures;
+}
+
+/**
+\brief Check that frame templates encode the same frames as amc_cmd_encode
+\return Number of failed checks
+*/
+static int check_templates(void)
+{
+	struct amc_drive drv, tpl_drv;
+	struct amc_frame_template tpl;
+	struct amc_command cmd;
+	const struct amc_command *tpl_cmd;
+	uint16_t payload[2] = {0x1234, 0x5678}, crc = 0, tpl_crc = 0;
+	int ctr, failures = 0;
+
+	amc_drive_new(&drv, 0x3F, -1);
+	amc_drive_new(&tpl_drv, 0x3F, -1);
+	drv.debug = tpl_drv.debug = 0;
+	amc_frame_template_init(&tpl, &tpl_drv, 0x45, 0x00, AMC_CMDTYPE_WRITE, sizeof(payload));
+
+	for (ctr = 0; ctr < 32; ctr++) {
+		cmd.index = 0x45;
+		cmd.offset = 0x00;
+		amc_cmd_encode(&drv, &cmd, AMC_CMDTYPE_WRITE, 0, payload, sizeof(payload), &crc);
+		amc_cmd_encode_template(&tpl_drv, &tpl, payload, &tpl_cmd, &tpl_crc);
+		if (memcmp(&cmd, tpl_cmd, sizeof(cmd)) || crc != tpl_crc) {
+			fprintf(stderr, "template: mismatch at sequence %d\n", drv.seq_ctr);
+			failures++;
+		}
+	}
+	return failures;
+}
+
+/**
+\brief Build a response frame
+\param *frame Where to store the frame
+\param seq Sequence number
+\param words Payload length announced in the header, in words
+\param fill Value of the payload bytes
+\param payload_bytes Payload bytes actually stored, with their CRC
+\return Length of the frame
+*/
+static int make_resp(uint8_t *frame, int seq, int words, uint8_t fill, int payload_bytes)
+{
+	struct amc_response rsp;
+	uint16_t crc;
+
+	rsp.sof = AMC_SOF_BYTE;
+	rsp.addr = 0xFF;
+	rsp.control.byte = 0;
+	rsp.control.bits.cmd = words ? AMC_CMDTYPE_WRITE : AMC_CMDTYPE_READ;
+	rsp.control.bits.seq = seq;
+	rsp.status1 = AMC_CMDRESP_COMPLETE;
+	rsp.status2 = 0;
+	rsp.payload_len = words;
+	rsp.crc = htons(amc_crc_update(0, &rsp, sizeof(rsp) - sizeof(uint16_t)));
+	memcpy(frame, &rsp, sizeof(rsp));
+	if (!payload_bytes) {
+		return sizeof(rsp);
+	}
+	memset(frame + sizeof(rsp), fill, payload_bytes);
+	crc = htons(amc_crc_update(0, frame + sizeof(rsp), payload_bytes));
+	memcpy(frame + sizeof(rsp) + payload_bytes, &crc, sizeof(crc));
+	return sizeof(rsp) + payload_bytes + sizeof(crc);
+}
+
+/**
+\brief Check batched CRC checks and frame spans against known answers
+\return Number of failed checks
+*/
+static int check_batch(void)
+{
+	enum { NUM_SPANS = 71 };
+	static const int bad[] = {0, 3, 4, 31, 32, NUM_SPANS - 1};
+	static const uint32_t expect_map[(NUM_SPANS + 31) / 32] = {
+		(1UL << 0) | (1UL << 3) | (1UL << 4) | (1UL << 31),
+		(1UL << 0),
+		(1UL << (NUM_SPANS - 1 - 64)),
+	};
+	static uint8_t data[NUM_SPANS][40];
+	struct amc_crc_span spans[NUM_SPANS];
+	uint32_t fail_map[(NUM_SPANS + 31) / 32];
+	uint8_t frame[64];
+	int ctr, len, ret, failures = 0;
+
+	srand(2);
+	for (ctr = 0; ctr < NUM_SPANS; ctr++) {
+		for (len = 0; len < sizeof(data[ctr]); len++) {
+			data[ctr][len] = rand();
+		}
+		/* Lanes of different lengths, including empty ones */
+		spans[ctr].data = data[ctr];
+		spans[ctr].len = (ctr * 7) % sizeof(data[ctr]);
+		spans[ctr].crc = htons(crc_bytewise(0, data[ctr], spans[ctr].len));
+	}
+	for (ctr = 0; ctr < sizeof(bad) / sizeof(bad[0]); ctr++) {
+		spans[bad[ctr]].crc ^= htons(0x0100);
+	}
+	memset(fail_map, 0xFF, sizeof(fail_map));
+	ret = amc_crc_check_batch(spans, NUM_SPANS, fail_map);
+	if (ret != sizeof(bad) / sizeof(bad[0])) {
+		fprintf(stderr, "batch: %d failures reported, expected %d\n",
+			ret, (int)(sizeof(bad) / sizeof(bad[0])));
+		failures++;
+	}
+	for (ctr = 0; ctr < (NUM_SPANS + 31) / 32; ctr++) {
+		if (fail_map[ctr] != expect_map[ctr]) {
+			fprintf(stderr, "batch: fail_map[%d] is %08X, expected %08X\n",
+				ctr, fail_map[ctr], expect_map[ctr]);
+			failures++;
+		}
+	}
+
+	/* A response with a payload, unaligned so the payload CRC is too */
+	len = make_resp(frame + 1, 3, 4, 0x5A, 8);
+	ret = amc_frame_crc_spans(frame + 1, len, spans);
+	if (ret != 2 || spans[1].data != frame + 1 + sizeof(struct amc_response) ||
+		spans[1].len != 8 || ntohs(spans[1].crc) != crc_bytewise(0, frame + 1 +
+		sizeof(struct amc_response), 8) || amc_crc_check_batch(spans, ret, fail_map) != 0) {
+		fprintf(stderr, "batch: payload span wrong (ret %d)\n", ret);
+		failures++;
+	}
+	frame[len] ^= 0x01;
+	ret = amc_frame_crc_spans(frame + 1, len, spans);
+	if (ret != 2 || amc_crc_check_batch(spans, ret, fail_map) != 1 || fail_map[0] != (1UL << 1)) {
+		fprintf(stderr, "batch: bad payload CRC not detected\n");
+		failures++;
+	}
+	if (amc_frame_crc_spans(frame + 1, len - 1, spans) != AMC_EFRAMEERR) {
+		fprintf(stderr, "batch: truncated frame not rejected\n");
+		failures++;
+	}
+	return failures;
+}
+
+/**
+\brief Feed bytes to a decoder in chunks until it completes or rejects a frame
+\param *p Decoder
+\param *data Bytes to feed
+\param len Number of bytes at *data
+\param chunk Largest number of bytes fed at once
+\param *used Location to store the number of bytes used
+\return Result of the last amc_parser_push
+*/
+static int push_chunks(struct amc_parser *p, const uint8_t *data, int len, int chunk, int *used)
+{
+	int ret = 0, n;
+
+	*used = 0;
+	while (ret == 0 && *used < len) {
+		n = (chunk < len - *used) ? chunk : len - *used;
+		ret = amc_parser_push(p, data + *used, n, &n);
+		*used += n;
+	}
+	return ret;
+}
+
+/* Bytes read back by the in-memory transports of check_parser and
+check_worker */
+static uint8_t mem_data[1024];
+static int mem_len, mem_pos;
+
+static ssize_t mem_writev(struct amc_transport *xprt, const struct iovec *iov, int iovcnt)
+{
+	ssize_t total = 0;
+	int ctr;
+
+	for (ctr = 0; ctr < iovcnt; ctr++) {
+		total += iov[ctr].iov_len;
+	}
+	return total;
+}
+
+/* Hands out at most 5 bytes per call, as a slow line would */
+static ssize_t mem_readv(struct amc_transport *xprt, const struct iovec *iov, int iovcnt)
+{
+	int ctr, n, total = 0;
+
+	for (ctr = 0; ctr < iovcnt && mem_pos < mem_len && total < 5; ctr++) {
+		n = mem_len - mem_pos;
+		if (n > iov[ctr].iov_len) n = iov[ctr].iov_len;
+		if (n > 5 - total) n = 5 - total;
+		memcpy(iov[ctr].iov_base, mem_data + mem_pos, n);
+		mem_pos += n;
+		total += n;
+	}
+	return total;
+}
+
+static int mem_wait(struct amc_transport *xprt, const struct timespec *timeout)
+{
+	return mem_pos < mem_len;
+}
+
+static void mem_flush(struct amc_transport *xprt)
+{
+	mem_pos = mem_len;
+}
+
+static void mem_close(struct amc_transport *xprt)
+{
+}
+
+static const struct amc_transport_ops mem_ops = {
+	.writev = mem_writev,
+	.readv = mem_readv,
+	.wait = mem_wait,
+	.flush = mem_flush,
+	.close = mem_close
+};
+
+/**
+\brief Check the response decoder on damaged, split and oversized frames
+\return Number of failed checks
+*/
+static int check_parser(void)
+{
+	static const uint8_t garbage[] = {0x00, AMC_SOF_BYTE, 0xFF, 0x13, AMC_SOF_BYTE, 0xFF, 0x00};
+	struct amc_parser p;
+	struct amc_drive drv;
+	struct amc_transport mem = {&mem_ops, -1, NULL};
+	struct amc_response rsp;
+	uint8_t stream[128], expect[8], buffer[8];
+	uint16_t crc;
+	int frame_len, len, chunk, used, ret, failures = 0;
+
+	/* Garbage, including start of frame bytes, in front of a frame */
+	memcpy(stream, garbage, sizeof(garbage));
+	frame_len = make_resp(stream + sizeof(garbage), 3, 4, 0x5A, 8);
+	len = sizeof(garbage) + frame_len;
+	memset(expect, 0x5A, sizeof(expect));
+	amc_parser_init(&p);
+	ret = push_chunks(&p, stream, len, len, &used);
+	if (ret != 1 || used != len || p.payload_size != 8 || memcmp(p.payload, expect, 8) ||
+		p.rsp.control.bits.seq != 3 || p.discarded != sizeof(garbage)) {
+		fprintf(stderr, "parser: no resync after garbage (ret %d)\n", ret);
+		failures++;
+	}
+
+	/* The same stream split at every chunk size */
+	for (chunk = 1; chunk < len; chunk++) {
+		amc_parser_init(&p);
+		ret = push_chunks(&p, stream, len, chunk, &used);
+		if (ret != 1 || used != len || memcmp(p.payload, expect, 8)) {
+			fprintf(stderr, "parser: failed with %d byte chunks (ret %d)\n", chunk, ret);
+			failures++;
+		}
+	}
+
+	/* A payload too large for the buffer is skipped, the next frame found.
+	The payload holds what looks like a response, which must not be taken */
+	len = make_resp(stream, 4, 16, 0, 32);
+	make_resp(stream + sizeof(rsp), 5, 4, 0x77, 8);
+	crc = htons(amc_crc_update(0, stream + sizeof(rsp), 32));
+	memcpy(stream + sizeof(rsp) + 32, &crc, sizeof(crc));
+	len += make_resp(stream + len, 5, 4, 0x5A, 8);
+	for (chunk = 1; chunk <= len; chunk++) {
+		amc_parser_init(&p);
+		amc_parser_set_payload(&p, buffer, sizeof(buffer));
+		ret = push_chunks(&p, stream, len, chunk, &used);
+		if (ret == AMC_EBUFSIZE) {
+			int rest;
+			ret = push_chunks(&p, stream + used, len - used, chunk, &rest);
+			used += rest;
+		}
+		else {
+			ret = -100;
+		}
+		if (ret != 1 || used != len || p.rsp.control.bits.seq != 5 || memcmp(buffer, expect, 8)) {
+			fprintf(stderr, "parser: no recovery from oversized payload with %d byte chunks "
+				"(ret %d)\n", chunk, ret);
+			failures++;
+		}
+	}
+
+	/* Through a drive, the rejected payload must not be left for the next read */
+	amc_drive_new_transport(&drv, 0x3F, &mem);
+	drv.debug = 0;
+	memcpy(mem_data, stream, len);
+	mem_len = len;
+	mem_pos = 0;
+	drv.seq_ctr = 4;
+	drv.rx_expect = 32;
+	ret = amc_resp_read(&drv, &rsp, buffer, sizeof(buffer));
+	if (ret != AMC_EBUFSIZE) {
+		fprintf(stderr, "parser: oversized payload read returned %d\n", ret);
+		failures++;
+	}
+	drv.seq_ctr = 5;
+	memset(buffer, 0, sizeof(buffer));
+	ret = amc_resp_read(&drv, &rsp, buffer, sizeof(buffer));
+	if (ret != sizeof(rsp) + 8 || memcmp(buffer, expect, 8)) {
+		fprintf(stderr, "parser: read after oversized payload returned %d\n", ret);
+		failures++;
+	}
+	amc_drive_destroy(&drv);
+	return failures;
+}
+
+/* Parameter memory of the drive answering on the transport of
+check_worker. At WORKER_WORD_INDEX each offset is one word of it, at
+WORKER_PARAM_INDEX each offset is a 32-bit parameter, as at 0x45 */
+#define WORKER_WORD_INDEX 0x20
+#define WORKER_PARAM_INDEX 0x8C
+static uint8_t reg_bytes[4 * 256 + AMC_MAX_PAYLOAD];
+static int reg_txns;
+
+/* Answers each command with the requested part of reg_bytes */
+static ssize_t reg_writev(struct amc_transport *xprt, const struct iovec *iov, int iovcnt)
+{
+	struct amc_command cmd;
+	struct amc_response rsp;
+	uint8_t *start;
+	uint16_t crc;
+	ssize_t total = 0;
+	int ctr, len;
+
+	for (ctr = 0; ctr < iovcnt; ctr++) {
+		total += iov[ctr].iov_len;
+	}
+	memcpy(&cmd, iov[0].iov_base, sizeof(cmd));
+	len = cmd.payload_len * sizeof(uint16_t);
+	start = reg_bytes + cmd.offset * ((cmd.index == WORKER_PARAM_INDEX) ? 4 : 2);
+
+	rsp.sof = AMC_SOF_BYTE;
+	rsp.addr = 0xFF;
+	rsp.control.byte = 0;
+	rsp.control.bits.cmd = AMC_CMDTYPE_WRITE; /* Data follows */
+	rsp.control.bits.seq = cmd.control.bits.seq;
+	rsp.status1 = AMC_CMDRESP_COMPLETE;
+	rsp.status2 = 0;
+	rsp.payload_len = cmd.payload_len;
+	rsp.crc = htons(amc_crc_update(0, &rsp, sizeof(rsp) - sizeof(uint16_t)));
+	memcpy(mem_data, &rsp, sizeof(rsp));
+	memcpy(mem_data + sizeof(rsp), start, len);
+	crc = htons(amc_crc_update(0, start, len));
+	memcpy(mem_data + sizeof(rsp) + len, &crc, sizeof(crc));
+	mem_len = sizeof(rsp) + len + sizeof(crc);
+	mem_pos = 0;
+	reg_txns++;
+	return total;
+}
+
+static const struct amc_transport_ops reg_ops = {
+	.writev = reg_writev,
+	.readv = mem_readv,
+	.wait = mem_wait,
+	.flush = mem_flush,
+	.close = mem_close
+};
+
+/**
+\brief Read through a bus worker as a background request
+\param *w Worker
+\param *drv Drive on the bus of the worker
+\param index Index to read
+\param word_addressed Passed on in the request
+\param *buffer Where to store the payload
+\param len Number of bytes to read
+\return Transactions the read took, -1 if it failed
+*/
+static int worker_read(struct amc_worker *w, struct amc_drive *drv, int index,
+	int word_addressed, uint8_t *buffer, int len)
+{
+	struct amc_request req;
+
+	memset(&req, 0, sizeof(req));
+	req.drv = drv;
+	req.index = index;
+	req.offset = 0x02;
+	req.access_type = AMC_CMDTYPE_READ;
+	req.buffer = buffer;
+	req.buffer_len = len;
+	req.priority = AMC_PRIO_BACKGROUND;
+	req.word_addressed = word_addressed;
+	reg_txns = 0;
+	if (amc_worker_submit(w, &req) || amc_request_wait(&req) < 0) {
+		return -1;
+	}
+	return reg_txns;
+}
+
+/**
+\brief Check that reads split by the bus worker match reads in one piece
+\return Number of failed checks
+*/
+static int check_worker(void)
+{
+	struct amc_drive drv;
+	struct amc_transport regs = {&reg_ops, -1, NULL};
+	struct amc_worker *w;
+	uint8_t whole[sizeof(struct amc_product_info)], sliced[sizeof(whole)];
+	int ctr, ret, failures = 0;
+
+	for (ctr = 0; ctr < sizeof(reg_bytes); ctr++) {
+		reg_bytes[ctr] = ctr * 31 + (ctr >> 8);
+	}
+	amc_drive_new_transport(&drv, 0x3F, &regs);
+	drv.debug = 0;
+	w = amc_worker_new(drv.bus);
+	if (w == NULL) {
+		perror("amc_worker_new");
+		amc_drive_destroy(&drv);
+		return 1;
+	}
+
+	/* Word addressed: split when asked to, the same bytes either way */
+	memset(whole, 0, sizeof(whole));
+	memset(sliced, 0, sizeof(sliced));
+	ret = worker_read(w, &drv, WORKER_WORD_INDEX, 0, whole, sizeof(whole));
+	if (ret != 1 || memcmp(whole, reg_bytes + 2 * 2, sizeof(whole))) {
+		fprintf(stderr, "worker: read in one piece returned %d\n", ret);
+		failures++;
+	}
+	ret = worker_read(w, &drv, WORKER_WORD_INDEX, 1, sliced, sizeof(sliced));
+	if (ret <= 1 || memcmp(sliced, whole, sizeof(whole))) {
+		fprintf(stderr, "worker: sliced read differs from read in one piece (%d transactions)\n", ret);
+		failures++;
+	}
+
+	/* Not word addressed: never split, even in the background class */
+	memset(sliced, 0, sizeof(sliced));
+	ret = worker_read(w, &drv, WORKER_PARAM_INDEX, 0, sliced, sizeof(sliced));
+	if (ret != 1 || memcmp(sliced, reg_bytes + 2 * 4, sizeof(sliced))) {
+		fprintf(stderr, "worker: parameter read split or corrupted (%d transactions)\n", ret);
+		failures++;
+	}
+
+	amc_worker_free(w);
+	amc_drive_destroy(&drv);
+	return failures;
+}
+
+/**
+\brief Check that a new drive handle gets through to a slow drive
+\param *port Serial device of the drive at 0x3F, typically amc-sim
+\param baud Baud rate
+\return Number of failed checks
+
+Meant for a drive that answers later than the turnaround a new handle
+assumes. The first write may time out, as writes are not retried, but
+it must widen the turnaround so that every transaction after it gets
+through, reads included.
+*/
+static int check_port(char *port, int baud)
+{
+	struct amc_drive drv;
+	uint16_t value;
+	int fd, ctr, failures = 0;
+
+	fd = amc_serial_open(port, baud);
+	if (fd == -1) {
+		fprintf(stderr, "Could not open %s\n", port);
+		return 1;
+	}
+	amc_drive_new(&drv, 0x3F, fd);
+	drv.debug = 0;
+	if (amc_get_access_control(&drv) < 0 && drv.bus->stats.timeouts == 0) {
+		fprintf(stderr, "port: first write failed without timing out\n");
+		failures++;
+	}
+	for (ctr = 0; ctr < 8; ctr++) {
+		if (amc_write_uint16(&drv, 0x20, ctr, 0x1234 + ctr) < 0) {
+			fprintf(stderr, "port: write %d failed\n", ctr);
+			failures++;
+		}
+		value = 0;
+		if (amc_get_uint16(&drv, 0x20, ctr, &value) < 0 || value != 0x1234 + ctr) {
+			fprintf(stderr, "port: read %d failed, %04X\n", ctr, value);
+			failures++;
+		}
+	}
+	fprintf(stderr, "port %s: %lu transactions, %lu timeouts, %lu seq errors, %lu retries\n",
+		port, drv.bus->stats.transactions, drv.bus->stats.timeouts,
+		drv.bus->stats.seq_errors, drv.bus->stats.retries);
+	amc_drive_destroy(&drv);
+	close(fd);
+	return failures;
+}
+
+static void bench_crc(void)
+{
+	uint8_t buffer[512];
+	int eng, sz, ctr;
+
+	for (ctr = 0; ctr < sizeof(buffer); ctr++) {
+		buffer[ctr] = ctr * 7;
+	}
+
+	for (eng = 0; eng < NUM_ENGINES; eng++) {
+		if (!engines[eng].available) continue;
+		for (sz = 0; sz < NUM_BLOCK_SIZES; sz++) {
+			long iterations = 0, batch = 1000;
+			uint16_t crc = 0;
+			double start = now(), elapsed;
+			do {
+				for (ctr = 0; ctr < batch; ctr++) {
+					crc = engines[eng].fn(crc, buffer, block_sizes[sz]);
+				}
+				iterations += batch;
+				elapsed = now() - start;
+			} while (elapsed < min_seconds);
+			sink = crc;
+			report("crc", engines[eng].name, block_sizes[sz], iterations, elapsed);
+		}
+	}
+}
+
+static void bench_crc_batch(void)
+{
+	enum { NUM_SPANS = 256 };
+	static uint8_t frames[NUM_SPANS][sizeof(struct amc_response)];
+	static struct amc_crc_span spans[NUM_SPANS];
+	uint32_t fail_map[NUM_SPANS / 32];
+	long iterations = 0;
+	double start, elapsed;
+	int ctr;
+
+	for (ctr = 0; ctr < NUM_SPANS; ctr++) {
+		struct amc_response *rsp = (struct amc_response *)frames[ctr];
+		memset(rsp, ctr, sizeof(*rsp));
+		rsp->sof = AMC_SOF_BYTE;
+		rsp->crc = htons(amc_crc_update(0, rsp, sizeof(*rsp) - sizeof(uint16_t)));
+		amc_frame_crc_spans(rsp, sizeof(*rsp), &spans[ctr]);
+	}
+
+	start = now();
+	do {
+		if (amc_crc_check_batch(spans, NUM_SPANS, fail_map) != 0) {
+			fprintf(stderr, "batch: unexpected CRC failure\n");
+			exit(1);
+		}
+		iterations += NUM_SPANS;
+		elapsed = now() - start;
+	} while (elapsed < min_seconds);
+	report("crc", "batch", spans[0].len, iterations, elapsed);
+}
+
+static void bench_encode(const char *name, int access_type, int response_len, int payload_len)
+{
+	struct amc_drive drv;
+	struct amc_command cmd;
+	uint16_t payload[255], payload_crc;
+	long iterations = 0, batch = 1000;
+	double start, elapsed;
+	int ctr, frame_len = 0;
+
+	amc_drive_new(&drv, 0x3F, -1);
+	drv.debug = 0;
+	memset(payload, 0x5A, sizeof(payload));
+	cmd.index = 0x45;
+	cmd.offset = 0x00;
+
+	start = now();
+	do {
+		for (ctr = 0; ctr < batch; ctr++) {
+			frame_len = amc_cmd_encode(&drv, &cmd, access_type, response_len,
+				payload, payload_len, &payload_crc);
+		}
+		iterations += batch;
+		elapsed = now() - start;
+	} while (elapsed < min_seconds);
+	sink = cmd.crc ^ payload_crc;
+	report("encode", name, frame_len, iterations, elapsed);
+	amc_drive_destroy(&drv);
+}
+
+static void bench_encode_template(const char *name, int access_type, int len)
+{
+	struct amc_drive drv;
+	struct amc_frame_template tpl;
+	const struct amc_command *cmd = NULL;
+	uint16_t payload[255], payload_crc = 0;
+	long iterations = 0, batch = 1000;
+	double start, elapsed;
+	int ctr, frame_len = 0;
+
+	amc_drive_new(&drv, 0x3F, -1);
+	drv.debug = 0;
+	memset(payload, 0x5A, sizeof(payload));
+	amc_frame_template_init(&tpl, &drv, 0x45, 0x00, access_type, len);
+
+	start = now();
+	do {
+		for (ctr = 0; ctr < batch; ctr++) {
+			frame_len = amc_cmd_encode_template(&drv, &tpl, payload, &cmd, &payload_crc);
+		}
+		iterations += batch;
+		elapsed = now() - start;
+	} while (elapsed < min_seconds);
+	sink = cmd->crc ^ payload_crc;
+	report("encode", name, frame_len, iterations, elapsed);
+	amc_drive_destroy(&drv);
+}
+
+static void bench_decode(const char *name, int payload_len)
+{
+	struct amc_drive drv;
+	struct amc_response rsp;
+	uint16_t payload[255], payload_crc = 0;
+	long iterations = 0, batch = 1000;
+	double start, elapsed;
+	int ctr, frame_len;
+
+	amc_drive_new(&drv, 0x3F, -1);
+	drv.debug = 0;
+	memset(payload, 0xA5, sizeof(payload));
+
+	rsp.sof = AMC_SOF_BYTE;
+	rsp.addr = 0xFF;
+	rsp.control.byte = 0;
+	rsp.control.bits.cmd = payload_len ? AMC_CMDTYPE_WRITE : AMC_CMDTYPE_READ;
+	rsp.control.bits.seq = drv.seq_ctr;
+	rsp.status1 = AMC_CMDRESP_COMPLETE;
+	rsp.status2 = 0;
+	rsp.payload_len = payload_len / sizeof(uint16_t);
+	rsp.crc = htons(amc_crc_update(0, &rsp, sizeof(rsp) - sizeof(uint16_t)));
+	frame_len = sizeof(rsp);
+	if (payload_len) {
+		payload_crc = htons(amc_crc_update(0, payload, payload_len));
+		frame_len += payload_len + sizeof(uint16_t);
+	}
+
+	start = now();
+	do {
+		for (ctr = 0; ctr < batch; ctr++) {
+			if (amc_resp_check_header(&drv, &rsp) != AMC_EOK ||
+				(payload_len && amc_resp_check_payload(&drv, &rsp, payload, payload_crc) != AMC_EOK)) {
+				fprintf(stderr, "decode %s: unexpected failure\n", name);
+				exit(1);
+			}
+		}
+		iterations += batch;
+		elapsed = now() - start;
+	} while (elapsed < min_seconds);
+	report("decode", name, frame_len, iterations, elapsed);
+	amc_drive_destroy(&drv);
+}
+
+static struct amc_fault_config faults;
+static int inject_faults = 0;
+static int use_uring = 0;
+static int threads = 0;
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static void bench_txn(struct amc_drive *drv, const char *name, int type, int len)
+{
+	enum { MAX_SAMPLES = 1 << 20 };
+	static double latency[MAX_SAMPLES];
+	uint8_t buffer[AMC_MAX_PAYLOAD];
+	long iterations = 0, failures = 0, samples;
+	double start, elapsed, before, after;
+
+	memset(buffer, 0, sizeof(buffer));
+	start = after = now();
+	do {
+		int ret;
+		before = after;
+		ret = (type == AMC_CMDTYPE_READ) ?
+			amc_get_string(drv, 0x45, 0x00, buffer, len) :
+			amc_write_string(drv, 0x45, 0x00, buffer, len);
+		after = now();
+		failures += (ret != 0);
+		if (iterations < MAX_SAMPLES) {
+			latency[iterations] = after - before;
+		}
+		iterations++;
+		elapsed = after - start;
+	} while (elapsed < min_seconds);
+
+	samples = (iterations < MAX_SAMPLES) ? iterations : MAX_SAMPLES;
+	qsort(latency, samples, sizeof(double), compare_double);
+	fprintf(stderr, "txn %s: goodput %.0f/s, %ld of %ld failed, latency p50 %.0f us, "
+		"p99 %.0f us, p999 %.0f us, max %.0f us\n", name,
+		(iterations - failures) / elapsed, failures, iterations,
+		latency[samples / 2] * 1e6, latency[samples * 99 / 100] * 1e6,
+		latency[samples * 999 / 1000] * 1e6, latency[samples - 1] * 1e6);
+	report("txn", name, len, iterations, elapsed);
+}
+
+/* Transactions of the priority classes in --threads: setpoint writes every
+10 ms due within 10 ms, status reads every 20 ms due within 20 ms, and
+product info reads back to back without a deadline */
+static const struct worker_class {
+	const char *name;
+	int access_type, index, len;
+	long period_us, deadline_us;
+} worker_classes[AMC_PRIO_CLASSES] = {
+	[AMC_PRIO_CONTROL] = {"control", AMC_CMDTYPE_WRITE, 0x45, 4, 10000, 10000},
+	[AMC_PRIO_STATUS] = {"status", AMC_CMDTYPE_READ, 0x02, 4, 20000, 20000},
+	[AMC_PRIO_BACKGROUND] = {"background", AMC_CMDTYPE_READ, 0x8C, sizeof(struct amc_product_info), 0, 0},
+};
+
+/* One application thread of --threads */
+struct worker_client {
+	pthread_t thread;
+	struct amc_worker *worker;
+	struct amc_drive *drv;
+	int priority;
+	double end;
+	long iterations, failures;
+	double max_latency;
+};
+
+static void *worker_client_run(void *arg)
+{
+	struct worker_client *wc = arg;
+	const struct worker_class *wcl = &worker_classes[wc->priority];
+	struct amc_request req;
+	uint8_t buffer[AMC_MAX_PAYLOAD];
+	double before, after, next = now();
+
+	memset(&req, 0, sizeof(req));
+	memset(buffer, 0, sizeof(buffer));
+	req.drv = wc->drv;
+	req.index = wcl->index;
+	req.offset = 0x00;
+	req.access_type = wcl->access_type;
+	if (wcl->access_type == AMC_CMDTYPE_WRITE) {
+		req.payload = buffer;
+		req.payload_len = wcl->len;
+	}
+	else {
+		req.buffer = buffer;
+		req.buffer_len = wcl->len;
+	}
+	req.priority = wc->priority;
+	req.deadline_us = wcl->deadline_us;
+	do {
+		before = now();
+		if (before < next) {
+			usleep((next - before) * 1e6);
+			before = now();
+		}
+		next += wcl->period_us * 1e-6;
+		amc_worker_submit(wc->worker, &req);
+		wc->failures += (amc_request_wait(&req) < 0);
+		after = now();
+		if (after - before > wc->max_latency) {
+			wc->max_latency = after - before;
+		}
+		wc->iterations++;
+	} while (after < wc->end);
+	return NULL;
+}
+
+/**
+\brief Time transactions from several threads sharing the drive through a bus worker
+\param *drv Drive to talk to
+\param count Number of threads
+
+Threads take turns at the priority classes, starting with control; with
+one thread only setpoint writes are timed.
+*/
+static void bench_worker(struct amc_drive *drv, int count)
+{
+	struct worker_client *clients;
+	struct amc_worker *worker;
+	struct amc_worker_stats stats;
+	long iterations[AMC_PRIO_CLASSES] = {0}, failures[AMC_PRIO_CLASSES] = {0};
+	double start, elapsed, max_latency[AMC_PRIO_CLASSES] = {0};
+	int ctr, prio;
+
+	worker = amc_worker_new(drv->bus);
+	clients = calloc(count, sizeof(struct worker_client));
+	if (worker == NULL || clients == NULL) {
+		perror("amc_worker_new");
+		exit(1);
+	}
+	start = now();
+	for (ctr = 0; ctr < count; ctr++) {
+		clients[ctr].worker = worker;
+		clients[ctr].drv = drv;
+		clients[ctr].priority = ctr % AMC_PRIO_CLASSES;
+		clients[ctr].end = start + min_seconds;
+		if (pthread_create(&clients[ctr].thread, NULL, worker_client_run, &clients[ctr])) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+	for (ctr = 0; ctr < count; ctr++) {
+		prio = clients[ctr].priority;
+		pthread_join(clients[ctr].thread, NULL);
+		iterations[prio] += clients[ctr].iterations;
+		failures[prio] += clients[ctr].failures;
+		if (clients[ctr].max_latency > max_latency[prio]) {
+			max_latency[prio] = clients[ctr].max_latency;
+		}
+	}
+	elapsed = now() - start;
+	amc_worker_get_stats(worker, &stats);
+	amc_worker_free(worker);
+	free(clients);
+
+	for (prio = 0; prio < AMC_PRIO_CLASSES && prio < count; prio++) {
+		fprintf(stderr, "worker %s: %d threads, goodput %.0f/s, %ld of %ld failed, "
+			"%lu deadlines missed, max latency %.0f us\n", worker_classes[prio].name,
+			(count - prio + AMC_PRIO_CLASSES - 1) / AMC_PRIO_CLASSES,
+			(iterations[prio] - failures[prio]) / elapsed, failures[prio], iterations[prio],
+			stats.missed[prio], max_latency[prio] * 1e6);
+		report("worker", worker_classes[prio].name, worker_classes[prio].len,
+			iterations[prio], elapsed);
+	}
+}
+
+/**
+\brief Time whole transactions over a port
+\param *port Serial device to use, or host:port of a serial device server
+\param tcp Nonzero if port is a device server
+\param baud Baud rate to open the serial device at, or of the device server
+\return 0 on success, -1 if the port cannot be opened
+*/
+static int bench_port(char *port, int tcp, int baud)
+{
+	struct amc_drive drv;
+	struct amc_transport tty;
+	static struct amc_fault fault;
+	struct amc_uring *ring = NULL;
+	struct amc_uring_stats ring_stats;
+
+	if (tcp) {
+		char host[256], *service;
+		snprintf(host, sizeof(host), "%s", port);
+		service = strrchr(host, ':');
+		if (service == NULL) {
+			fprintf(stderr, "Expected host:port, got %s\n", port);
+			return -1;
+		}
+		*service++ = '\0';
+		if (amc_tcp_open(&tty, host, service, 2000)) {
+			perror(port);
+			return -1;
+		}
+	}
+	else {
+		int fd = amc_serial_open(port, baud);
+		if (fd == -1) {
+			fprintf(stderr, "Could not open %s\n", port);
+			return -1;
+		}
+		if (use_uring) {
+			ring = amc_uring_new(1);
+			if (ring == NULL) {
+				perror("io_uring, using the tty transport");
+			}
+		}
+		amc_uring_transport(ring, &tty, fd);
+	}
+	if (inject_faults) {
+		amc_fault_init(&fault, &tty, &faults);
+		amc_drive_new_transport(&drv, 0x3F, &fault.xprt);
+	}
+	else {
+		amc_drive_new_transport(&drv, 0x3F, &tty);
+	}
+	drv.debug = 0;
+	if (tcp) {
+		drv.bus->baud = baud;
+	}
+	amc_get_access_control(&drv);
+
+	if (threads > 0) {
+		bench_worker(&drv, threads);
+	}
+	else {
+		bench_txn(&drv, "read4", AMC_CMDTYPE_READ, 4);
+		bench_txn(&drv, "write4", AMC_CMDTYPE_WRITE, 4);
+		bench_txn(&drv, "read510", AMC_CMDTYPE_READ, 510);
+		bench_txn(&drv, "write510", AMC_CMDTYPE_WRITE, 510);
+	}
+	fprintf(stderr, "port %s: %lu transactions, %lu timeouts, %lu seq errors, %lu crc errors, "
+		"%lu retries, %lu failures\n", port, drv.bus->stats.transactions, drv.bus->stats.timeouts,
+		drv.bus->stats.seq_errors, drv.bus->stats.crc_errors, drv.bus->stats.retries, drv.bus->stats.failures);
+	if (inject_faults) {
+		fprintf(stderr, "faults: %lu flips, %lu drops, %lu dups, %lu truncations, %lu delays, "
+			"%lu stale\n", fault.stats.flips, fault.stats.drops, fault.stats.dups,
+			fault.stats.truncations, fault.stats.delays, fault.stats.stale);
+	}
+	if (ring != NULL) {
+		amc_uring_get_stats(ring, &ring_stats);
+		fprintf(stderr, "io_uring: %lu enters (%.2f per transaction), %lu submitted, "
+			"%lu completed\n", ring_stats.enters,
+			(double)ring_stats.enters / (drv.bus->stats.transactions ? drv.bus->stats.transactions : 1),
+			ring_stats.submitted, ring_stats.completed);
+	}
+
+	amc_drive_destroy(&drv);
+	amc_transport_close(&tty);
+	amc_uring_free(ring);
+	return 0;
+}
+
+/* Ports driven at once by --loop */
+#define LOOP_MAX_PORTS 64
+
+struct loop_port {
+	struct amc_transport xprt;
+	struct amc_drive drv;
+	struct amc_loop_txn txn;
+	uint8_t buffer[4];
+	long done;
+	long failed;
+};
+
+static struct amc_loop *loop;
+static double loop_end;
+
+/* Each port keeps one read in flight until the run time is up */
+static void loop_done(struct amc_loop_txn *txn)
+{
+	struct loop_port *lp = txn->user;
+
+	lp->done++;
+	lp->failed += (txn->result < 0);
+	if (now() < loop_end) {
+		amc_loop_submit(loop, txn);
+	}
+}
+
+/**
+\brief Time reads on many ports at once, from one thread
+\param *list Comma separated serial devices, each with a drive at 3F
+\param baud Baud rate to open the devices at
+\return 0 on success, -1 if a port cannot be opened
+*/
+static int bench_loop(char *list, int baud)
+{
+	static struct loop_port ports[LOOP_MAX_PORTS];
+	char *dev, *save = NULL;
+	long done = 0, failed = 0;
+	double start, elapsed;
+	int count = 0, ctr;
+
+	loop = amc_loop_new();
+	if (loop == NULL) {
+		perror("amc_loop_new");
+		return -1;
+	}
+	for (dev = strtok_r(list, ",", &save); dev != NULL && count < LOOP_MAX_PORTS;
+		dev = strtok_r(NULL, ",", &save)) {
+		struct loop_port *lp = &ports[count];
+		int fd = amc_serial_open(dev, baud);
+		if (fd == -1) {
+			fprintf(stderr, "Could not open %s\n", dev);
+			return -1;
+		}
+		amc_transport_tty(&lp->xprt, fd);
+		amc_drive_new_transport(&lp->drv, 0x3F, &lp->xprt);
+		lp->drv.debug = 0;
+		amc_get_access_control(&lp->drv);
+		if (amc_loop_add_port(loop, &lp->xprt)) {
+			perror(dev);
+			return -1;
+		}
+		lp->txn.drv = &lp->drv;
+		lp->txn.index = 0x45;
+		lp->txn.offset = 0x00;
+		lp->txn.access_type = AMC_CMDTYPE_READ;
+		lp->txn.buffer = lp->buffer;
+		lp->txn.buffer_len = sizeof(lp->buffer);
+		lp->txn.done = loop_done;
+		lp->txn.user = lp;
+		count++;
+	}
+
+	start = now();
+	loop_end = start + min_seconds;
+	for (ctr = 0; ctr < count; ctr++) {
+		amc_loop_submit(loop, &ports[ctr].txn);
+	}
+	while (amc_loop_pending(loop) > 0) {
+		if (amc_loop_dispatch(loop, 100) < 0) {
+			perror("amc_loop_dispatch");
+			break;
+		}
+	}
+	elapsed = now() - start;
+
+	for (ctr = 0; ctr < count; ctr++) {
+		done += ports[ctr].done;
+		failed += ports[ctr].failed;
+	}
+	fprintf(stderr, "loop read4: %d ports, goodput %.0f/s, %ld of %ld failed\n",
+		count, (done - failed) / elapsed, failed, done);
+	report("loop", "read4", 4, done, elapsed);
+
+	amc_loop_free(loop);
+	for (ctr = 0; ctr < count; ctr++) {
+		amc_drive_destroy(&ports[ctr].drv);
+		amc_transport_close(&ports[ctr].xprt);
+	}
+	return 0;
+}
+
+char *usage_string =
+"Benchmark CRC engines and frame encoding/decoding of the AMC library\n"
+"Usage:\n"
+"--time=<s>: Minimum run time of each measurement in seconds (default 0.2)\n"
+"--check: Only run the known-answer checks, and with --port check that a new\n"
+"  handle gets through to a slow drive\n"
+"--port=<dev>: Time read and write transactions with the drive at 3F on dev\n"
+"--tcp=<host:port>: As --port, through a serial device server\n"
+"--baud=<n>: Baud rate for --port, or of the device server (default 115200)\n"
+"--uring: Drive --port through io_uring, if the kernel supports it\n"
+"--threads=<n>: Time writes and reads of each priority class over --port from n\n"
+"  threads sharing a bus worker\n"
+"--loop=<dev>[,<dev>...]: Time reads on all devices at once from one event loop\n"
+"Faults injected into responses with --port, probabilities in parts per million:\n"
+"--flip=<ppm>, --drop=<ppm>, --dup=<ppm>: Per byte bit flips, losses, repeats\n"
+"--truncate=<ppm>: Per read, lose the rest of the bytes\n"
+"--delay=<ppm>[,us]: Per read, hold the bytes back (default 20000 us)\n"
+"--stale=<ppm>: Per response, insert a repeat of the previous one\n"
+"--seed=<n>: Seed of the fault generator (default 1)\n"
+"\n"
+"Output columns: kind,name,bytes,iterations,ns_per_op,ops_per_s,mb_per_s\n"
+;
+
+static struct option opt_lst[] = {
+	{"time", required_argument, 0, 't'},
+	{"check", no_argument, 0, 'c'},
+	{"port", required_argument, 0, 'p'},
+	{"tcp", required_argument, 0, 'n'},
+	{"baud", required_argument, 0, 'b'},
+	{"uring", no_argument, 0, 'u'},
+	{"loop", required_argument, 0, 'l'},
+	{"threads", required_argument, 0, 'm'},
+	{"flip", required_argument, 0, 'F'},
+	{"drop", required_argument, 0, 'D'},
+	{"dup", required_argument, 0, 'U'},
+	{"truncate", required_argument, 0, 'T'},
+	{"delay", required_argument, 0, 'L'},
+	{"stale", required_argument, 0, 'S'},
+	{"seed", required_argument, 0, 's'},
+	{"help", no_argument, 0, 'h'},
+	{NULL, 0, 0, 0}
+};
+
+int main(int argc, char *argv[])
+{
+	int opt, opt_idx, check_only = 0;
+	int eng, baud = 115200;
+	char *port = NULL, *loop_ports = NULL;
+	int tcp = 0;
+
+	faults.seed = 1;
+	faults.delay_us = 20000;
+	while (-1 != (opt = getopt_long(argc, argv, "t:cp:n:b:ul:m:F:D:U:T:L:S:s:h", opt_lst, &opt_idx))) {
+		switch (opt) {
+		case 't':
+			min_seconds = strtod(optarg, NULL);
+			break;
+		case 'c':
+			check_only = 1;
+			break;
+		case 'p':
+			port = optarg;
+			tcp = 0;
+			break;
+		case 'n':
+			port = optarg;
+			tcp = 1;
+			break;
+		case 'b':
+			baud = atoi(optarg);
+			break;
+		case 'u':
+			use_uring = 1;
+			break;
+		case 'l':
+			loop_ports = optarg;
+			break;
+		case 'm':
+			threads = atoi(optarg);
+			break;
+		case 'F':
+			faults.flip_ppm = atoi(optarg);
+			inject_faults = 1;
+			break;
+		case 'D':
+			faults.drop_ppm = atoi(optarg);
+			inject_faults = 1;
+			break;
+		case 'U':
+			faults.dup_ppm = atoi(optarg);
+			inject_faults = 1;
+			break;
+		case 'T':
+			faults.truncate_ppm = atoi(optarg);
+			inject_faults = 1;
+			break;
+		case 'L':
+			{
+				char *next_ptr;
+				faults.delay_ppm = strtol(optarg, &next_ptr, 10);
+				if (*next_ptr == ',') {
+					faults.delay_us = strtol(next_ptr + 1, NULL, 10);
+				}
+				inject_faults = 1;
+			}
+			break;
+		case 'S':
+			faults.stale_ppm = atoi(optarg);
+			inject_faults = 1;
+			break;
+		case 's':
+			faults.seed = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			puts(usage_string);
+			return (opt == 'h') ? 0 : -1;
+		}
+	}
+
+	for (eng = 0; eng < NUM_ENGINES; eng++) {
+#ifdef AMC_CRC_HAVE_CLMUL
+		if (engines[eng].fn == amc_crc_update_clmul) {
+			engines[eng].available = amc_crc_have_clmul();
+		}
+#endif
+	}
+
+	if (check_engines() || check_batch() || check_templates() || check_parser() ||
+		check_worker()) {
+		fprintf(stderr, "Known-answer checks failed\n");
+		return 1;
+	}
+	if (check_only) {
+		return (port != NULL && !tcp && check_port(port, baud)) ? 1 : 0;
+	}
+
+	printf("kind,name,bytes,iterations,ns_per_op,ops_per_s,mb_per_s\n");
+	if (port != NULL) {
+		return bench_port(port, tcp, baud) ? 1 : 0;
+	}
+	if (loop_ports != NULL) {
+		return bench_loop(loop_ports, baud) ? 1 : 0;
+	}
+	bench_crc();
+	bench_crc_batch();
+	bench_encode("read", AMC_CMDTYPE_READ, 4, 0);
+	bench_encode("write4", AMC_CMDTYPE_WRITE, 0, 4);
+	bench_encode("write510", AMC_CMDTYPE_WRITE, 0, 510);
+	bench_encode_template("template-read", AMC_CMDTYPE_READ, 4);
+	bench_encode_template("template-write4", AMC_CMDTYPE_WRITE, 4);
+	bench_decode("ack", 0);
+	bench_decode("read4", 4);
+	bench_decode("read356", sizeof(struct amc_product_info));
+	bench_decode("read510", 510);
+	return 0;
+}
@@ -28,19 +28,43 @@ the output is displayed in greater detail.
 
 char serial_device[256] = "/dev/ttyM0";
 int baudrate = 115200;
+int serial_flags = 0;
+struct amc_rs485 rs485_cfg = { 0, 1, 0, 0, 0 };
 
 int open_drive(struct amc_drive *drv, char *serial_device, int baudrate, int serial_mode, int *serial_fd)
 {
-	*serial_fd = amc_serial_open(serial_device, baudrate);
+	int applied;
+
+	*serial_fd = amc_serial_open_flags(serial_device, baudrate, serial_flags, &applied);
 
 	if (*serial_fd == -1) {
 		return -1;
 	}
+	if (serial_flags) {
+		printf("Low latency:%s%s%s\n",
+			(applied & AMC_SERIAL_ASYNC_LOW_LATENCY) ? " async_low_latency" : "",
+			(applied & AMC_SERIAL_USB_LATENCY_TIMER) ? " latency_timer" : "",
+			(applied & AMC_SERIAL_POLLED_READ) ? " polled_read" : "");
+	}
+	if (amc_serial_get_baud(*serial_fd) != baudrate) {
+		printf("Requested %d baud, port runs at %d baud\n", baudrate,
+			amc_serial_get_baud(*serial_fd));
+	}
 
 #ifdef MOXA
 	ioctl(*serial_fd, MOXA_SET_OP_MODE, &serial_mode);
 #endif
 
+	if (rs485_cfg.enabled) {
+		if (0 != amc_serial_set_rs485(*serial_fd, &rs485_cfg)) {
+			printf("RS-485 mode is not supported by %s\n", serial_device);
+			return -1;
+		}
+		printf("RS-485: RTS %s on send, delay %d ms before, %d ms after\n",
+			rs485_cfg.rts_on_send ? "high" : "low",
+			rs485_cfg.delay_before_send_ms, rs485_cfg.delay_after_send_ms);
+	}
+
 	if (0 != amc_drive_new(drv, 0x3F, *serial_fd)) {
 		return -1;
 	}
@@ -50,6 +74,38 @@ int open_drive(struct amc_drive *drv, char *serial_device, int baudrate, int ser
 	return 0;
 }
 
+struct amc_transport tcp_xprt;
+
+int open_drive_tcp(struct amc_drive *drv, char *server, int *serial_fd)
+{
+	char host[256], *port;
+
+	strncpy(host, server, sizeof(host) - 1);
+	host[sizeof(host) - 1] = '\0';
+	port = strrchr(host, ':');
+	if (port == NULL) {
+		printf("Expected host:port, got %s\n", server);
+		return -1;
+	}
+	*port++ = '\0';
+
+	if (0 != amc_tcp_open(&tcp_xprt, host, port, 2000)) {
+		perror(server);
+		return -1;
+	}
+	*serial_fd = tcp_xprt.fd;
+
+	if (0 != amc_drive_new_transport(drv, 0x3F, &tcp_xprt)) {
+		return -1;
+	}
+	/* The line runs at whatever the device server is set to */
+	drv->bus->baud = baudrate;
+
+	amc_get_access_control(drv);
+
+	return 0;
+}
+
 #define KP 30.0
 #define KI 1.0
 #define KS 20000.0
@@ -63,6 +119,10 @@ enum {
 	OPT_GETID = 256,
 	OPT_DEBUG,
 	OPT_PORT,
+	OPT_BAUD,
+	OPT_LOWLATENCY,
+	OPT_RS485,
+	OPT_TCP,
 	OPT_ENABLEBRIDGE,
 	OPT_QUICKSTOP,
 	OPT_RESETEVENTS,
@@ -81,6 +141,11 @@ char *usage_string =
 "Usage:\n"
 "--getid: Retrieve drive ID string and version numbers\n"
 "--port=<dev>: Set serial port device to dev\n"
+"--baud=<n>: Set baud rate to n, any rate the port supports (default 115200)\n"
+"--lowlatency: Tune the port for low latency, reports the settings applied\n"
+"--tcp=<host:port>: Talk to the drive through a serial device server\n"
+"--rs485[=before,after]: Let the kernel drive RTS as RS-485 transmit enable,\n"
+"        with optional delays in ms before and after sending\n"
 "--debug: Show serial comms debug messages\n"
 "--bridgestatus: Retrieve power bridge status\n"
 "--enablebridge[=n]: Enable the power bridge, n=0 disables, n=1 enables\n"
@@ -100,6 +165,10 @@ char *usage_string =
 static struct option opt_lst[] = {
 	{"debug", no_argument, 0, OPT_DEBUG},
 	{"port", required_argument, 0, OPT_PORT},
+	{"baud", required_argument, 0, OPT_BAUD},
+	{"lowlatency", no_argument, 0, OPT_LOWLATENCY},
+	{"rs485", optional_argument, 0, OPT_RS485},
+	{"tcp", required_argument, 0, OPT_TCP},
 
 	{"getid", no_argument, 0, OPT_GETID},
 	{"bridgestatus", no_argument, 0, OPT_BRIDGESTATUS},
@@ -123,6 +192,7 @@ int main(int argc, char *argv[])
 	int opt_idx, opt_errors = 0, opt;
 	int serial_mode = 0;
 	int serial_fd;
+	char *tcp_server = NULL;
 
 #ifdef MOXA
 	serial_mode = RS422_MODE;
@@ -135,20 +205,57 @@ int main(int argc, char *argv[])
 	
 	drv = malloc(sizeof(struct amc_drive));
 
-	if (-1 == open_drive(drv, serial_device, baudrate, serial_mode, &serial_fd)) {
-		printf("Could not open %s\n", serial_device);
+	/* Settle the connection settings first, so they can come in any order */
+	opterr = 0;
+	while (-1 != (opt = getopt_long(argc, argv, "dv", opt_lst, &opt_idx))) {
+		switch(opt) {
+		case OPT_PORT:
+			strncpy(serial_device, optarg, 256);
+			tcp_server = NULL;
+			break;
+		case OPT_TCP:
+			tcp_server = optarg;
+			break;
+		case OPT_BAUD:
+			baudrate = atoi(optarg);
+			break;
+		case OPT_LOWLATENCY:
+			serial_flags = AMC_SERIAL_LOW_LATENCY;
+			break;
+		case OPT_RS485:
+			rs485_cfg.enabled = 1;
+			if (optarg != NULL) {
+				char *next_ptr;
+				rs485_cfg.delay_before_send_ms = strtol(optarg, &next_ptr, 10);
+				if (*next_ptr == ',') {
+					rs485_cfg.delay_after_send_ms = strtol(next_ptr + 1, NULL, 10);
+				}
+			}
+			break;
+		}
+	}
+
+	if (tcp_server != NULL) {
+		if (-1 == open_drive_tcp(drv, tcp_server, &serial_fd)) {
+			printf("Could not connect to %s\n", tcp_server);
+			return -1;
+		}
+	}
+	else if (-1 == open_drive(drv, serial_device, baudrate, serial_mode, &serial_fd)) {
+		printf("Could not open %s at %d baud\n", serial_device, baudrate);
 		return -1;
 	}
 
+	optind = 1;
+	opterr = 1;
 	while (-1 != (opt = getopt_long(argc, argv, "dv", opt_lst, &opt_idx))) {
 		switch(opt) {
 		case OPT_PORT:
-			strncpy(serial_device, optarg, 256);
-			close(serial_fd);
-			if (-1 == open_drive(drv, serial_device, baudrate, serial_mode, &serial_fd)) {
-					printf("Could not open %s\n", serial_device);
-					return -1;
-			}
+		case OPT_TCP:
+		case OPT_BAUD:
+		case OPT_LOWLATENCY:
+		case OPT_RS485:
+			/* Already applied */
 			break;
 		case OPT_GETID:
 			{